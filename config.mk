@@ -7,6 +7,8 @@ COMMON = ../common
 WM = src/wm
 MENU = src/menu
 KB = src/kb
+WMCTL = src/wmctl
+BENCH = src/bench
 
 # x11
 X11INC = /usr/X11R6/include
@@ -21,8 +23,8 @@ INCS = -I${X11INC} -I${FREETYPEINC} -I${COMMON} -I${WM} -I${MENU}
 
 # flags
 CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_XOPEN_SOURCE=700 -D_POSIX_C_SOURCE=200809L -DVERSION=\"$(VERSION)\"
-CFLAGS   = -std=c99 -g -pedantic -Wall -Wno-deprecated-declarations -Os ${INCS} ${CPPFLAGS}
-LDFLAGS = -L${X11LIB} -lX11 ${FREETYPELIBS} -lXtst
+CFLAGS   = -std=c99 -g -pedantic -Wall -Wno-deprecated-declarations -Os -pthread ${INCS} ${CPPFLAGS}
+LDFLAGS = -L${X11LIB} -lX11 ${FREETYPELIBS} -lXtst -pthread
 
 # compiler and linker
 CC = cc
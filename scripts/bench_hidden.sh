@@ -0,0 +1,49 @@
+#!/bin/bash
+# Measures the CPU used by N background apps and the X server while one app
+# is on top. Run it once with hidebackground = 0 and once with
+# hidebackground = 1 in src/wm/wm.h to see what hiding saves.
+#
+# usage: bench_hidden.sh [apps] [seconds] [command...]
+# default command is "xterm -e top -d 0.1", which repaints continuously.
+set -e
+
+N=${1:-8}
+SECS=${2:-20}
+shift 2 2>/dev/null || shift $#
+CMD=("$@")
+[ ${#CMD[@]} -eq 0 ] && CMD=(xterm -e top -d 0.1)
+HZ=$(getconf CLK_TCK)
+
+# utime + stime of a pid and its children, in clock ticks
+ticks() {
+	local t=0 p
+	for p in "$@" $(pgrep -P "$(echo "$@" | tr ' ' ,)" 2>/dev/null); do
+		[ -r /proc/$p/stat ] || continue
+		t=$((t + $(awk '{ print $14 + $15 }' /proc/$p/stat)))
+	done
+	echo $t
+}
+
+pids=()
+trap 'kill "${pids[@]}" 2>/dev/null' EXIT
+for i in $(seq "$N"); do
+	"${CMD[@]}" >/dev/null 2>&1 &
+	pids+=($!)
+done
+sleep 3 # let the apps map and the wm settle
+
+xorg=$(pgrep -o -x Xorg || pgrep -o -x X || true)
+hidden=$(wmctl dump | grep -c '"ishidden": 1' || true)
+
+a0=$(ticks "${pids[@]}")
+x0=$( [ -n "$xorg" ] && ticks "$xorg" || echo 0 )
+sleep "$SECS"
+a1=$(ticks "${pids[@]}")
+x1=$( [ -n "$xorg" ] && ticks "$xorg" || echo 0 )
+
+awk -v n="$N" -v h="$hidden" -v s="$SECS" -v hz="$HZ" \
+    -v a=$((a1 - a0)) -v x=$((x1 - x0)) 'BEGIN {
+	printf "apps: %d (%d hidden), %d s\n", n, h, s
+	printf "apps cpu: %.1f%%\n", 100 * a / hz / s
+	printf "X cpu:    %.1f%%\n", 100 * x / hz / s
+}'
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Runs src/bench/ipcbench against a fresh wm in a headless Xvfb session.
+# wm listens on the fixed /tmp/xwm, so do not run this next to a live wm.
+# Build first with: make wm bench
+#
+# usage: bench_ipc.sh [ipcbench options]
+#   e.g. bench_ipc.sh -c 32 -d 10 -n 300 -w 4,1,1
+set -e
+
+cd "$(dirname "$0")/.."
+DISPLAY_NUM=${DISPLAY_NUM:-:99}
+
+Xvfb "$DISPLAY_NUM" -screen 0 1280x800x24 -nolisten tcp &
+XVFB=$!
+trap 'kill $WM $XVFB 2>/dev/null' EXIT
+export DISPLAY=$DISPLAY_NUM
+for i in $(seq 50); do
+	xdpyinfo >/dev/null 2>&1 && break
+	sleep 0.1
+done
+
+bin/wm 2>/dev/null &
+WM=$!
+for i in $(seq 50); do
+	[ -S /tmp/xwm ] && break
+	sleep 0.1
+done
+
+src/bench/ipcbench "$@"
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Compares the latency of switching clients the old way (nc twice plus cut)
+# with wmctl -m. menu is replaced by a stub that picks the second entry, so
+# only the IPC and process overhead is measured. Needs a running wm with at
+# least two clients.
+#
+# usage: bench_switch.sh [rounds]
+set -e
+
+ROUNDS=${1:-200}
+SOCKET_PATH="/tmp/xwm"
+STUB=$(mktemp -d)
+trap 'rm -rf "$STUB"' EXIT
+printf '#!/bin/sh\nsed -n 2p\n' > "$STUB/menu"
+chmod +x "$STUB/menu"
+export PATH="$STUB:$PATH"
+
+old() {
+	selected_client=$(printf "0\n" | nc -U "$SOCKET_PATH" | menu -p 'Switch App: ')
+	selected_pos=$(printf "%s\n" "$selected_client" | cut -d ' ' -f1)
+	printf "1\n%s\n" "$selected_pos" | nc -U "$SOCKET_PATH" >/dev/null
+}
+
+new() {
+	wmctl -m -p 'Switch App: '
+}
+
+# mean wall time of one call of $1 in microseconds
+run() {
+	local start end i
+	start=$(date +%s%N)
+	for i in $(seq "$ROUNDS"); do
+		"$1"
+	done
+	end=$(date +%s%N)
+	echo $(( (end - start) / ROUNDS / 1000 ))
+}
+
+o=$(run old)
+n=$(run new)
+echo "rounds: $ROUNDS"
+echo "nc + cut: $o us per switch"
+echo "wmctl -m: $n us per switch"
@@ -0,0 +1,127 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * drwbench - times drw_fontset_getwidth(), the TEXTW() of wm, menu and kb.
+ * Measures 1k, 10k and 100k widths of ASCII titles, Latin-1 names and
+ * mixed CJK strings. The first pass over each set also fills the advance
+ * caches and is reported separately. Then it times full redraws shaped
+ * like a menu (one drw_text() per row) and like kb (one per key), each
+ * followed by XSync() so the server's share is included. Needs a
+ * display, e.g. Xvfb.
+ *
+ * usage: drwbench [font ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+
+#include "../common/drw.h"
+#include "../common/util.h"
+
+#define LENGTH(X)	(sizeof X / sizeof X[0])
+#define ROUNDS		1000
+
+static const char *ascii[] = {
+	"xterm", "Firefox - Mozilla Firefox", "vim src/common/drw.c",
+	"make: Nothing to be done for 'all'.", "~/src/xwm$ git log --oneline",
+	"Terminal 80x24", "wm 0.1", "Alt + Shift + J",
+};
+static const char *latin1[] = {
+	"Café Müller", "Ångström – naïve façade", "Ærøskøbing", "Señor Gómez",
+	"Déjà vu", "Straße", "Œuvres complètes", "¿Qué pasó?",
+};
+static const char *mixed[] = {
+	"東京 - 地図", "README 日本語版", "설정 - Settings", "中文输入法",
+	"Ελληνικά κείμενο", "Русский текст", "ファイル (2)", "テスト abc",
+};
+
+static const char *colors[] = { "#ffffff", "#000000", "#000000" };
+
+static long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Returns the ns per width of n drw_fontset_getwidth() calls over set. */
+static double
+bench(Drw *drw, const char **set, size_t len, int n)
+{
+	long long start;
+	volatile unsigned int w = 0;
+	int i;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		w += drw_fontset_getwidth(drw, set[i % len]);
+	return (double)(now() - start) / n;
+}
+
+/* Returns the us per redraw of rows x cols cells of text filling the pixmap. */
+static double
+redraw(Drw *drw, int rows, int cols)
+{
+	long long start;
+	unsigned int w = drw->w / cols, h = drw->h / rows;
+	int i, r, c;
+
+	start = now();
+	for (i = 0; i < ROUNDS; i++) {
+		for (r = 0; r < rows; r++)
+			for (c = 0; c < cols; c++)
+				drw_text(drw, c * w, r * h, w, h, 2, ascii[(r * cols + c) % LENGTH(ascii)], i & 1);
+		XSync(drw->dpy, False);
+	}
+	return (double)(now() - start) / ROUNDS / 1000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const char *deffonts[] = { "monospace:size=10" };
+	static const struct { const char *name; const char **set; size_t len; } sets[] = {
+		{ "ascii",  ascii,  LENGTH(ascii) },
+		{ "latin1", latin1, LENGTH(latin1) },
+		{ "mixed",  mixed,  LENGTH(mixed) },
+	};
+	static const int counts[] = { 1000, 10000, 100000 };
+	const char **fonts = argc > 1 ? (const char **)argv + 1 : deffonts;
+	size_t nfonts = argc > 1 ? (size_t)argc - 1 : LENGTH(deffonts);
+	Display *dpy;
+	Drw *drw;
+	size_t i, j;
+	int screen;
+
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("drwbench: cannot open display");
+	screen = DefaultScreen(dpy);
+	drw = drw_create(dpy, screen, RootWindow(dpy, screen), 1, 1);
+	if (!drw_fontset_create(drw, fonts, nfonts))
+		die("drwbench: no fonts could be loaded");
+
+	printf("%-8s %10s", "set", "cold ns");
+	for (j = 0; j < LENGTH(counts); j++)
+		printf(" %9dx ns", counts[j]);
+	putchar('\n');
+	for (i = 0; i < LENGTH(sets); i++) {
+		printf("%-8s %10.0f", sets[i].name,
+			bench(drw, sets[i].set, sets[i].len, sets[i].len));
+		for (j = 0; j < LENGTH(counts); j++)
+			printf(" %12.0f", bench(drw, sets[i].set, sets[i].len, counts[j]));
+		putchar('\n');
+	}
+
+	drw_setscheme(drw, drw_scm_create(drw, colors, LENGTH(colors)));
+	drw_resize(drw, 1280, 20 * drw->fonts->h);
+	printf("%-8s %10.1f us per redraw, 20 rows\n", "menu", redraw(drw, 20, 1));
+	drw_resize(drw, 1280, 400);
+	printf("%-8s %10.1f us per redraw, 4x10 keys\n", "keyboard", redraw(drw, 4, 10));
+	drw_free(drw);
+	XCloseDisplay(dpy);
+	return EXIT_SUCCESS;
+}
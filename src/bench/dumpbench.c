@@ -0,0 +1,57 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * dumpbench - times the GetClients and StateDump serializers of wm.
+ * wm.c is built into this file so that its static handlers can be called
+ * without a display; the clients are fabricated, names include characters
+ * that need JSON escaping.
+ *
+ * usage: dumpbench [clients] [rounds]
+ */
+#define main wmmain
+#include "../wm/wm.c"
+#undef main
+
+static double
+bench(char *(*handler)(char *), int rounds, size_t *len)
+{
+	long long start;
+	int i;
+
+	handler(NULL); /* first round grows reply */
+	start = monotonicus();
+	for (i = 0; i < rounds; i++)
+		*len = strlen(handler(NULL));
+	return (double)(monotonicus() - start) / rounds;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, n = argc > 1 ? atoi(argv[1]) : 1000;
+	int rounds = argc > 2 ? atoi(argv[2]) : 1000;
+	size_t cap, len;
+	double us;
+	Client *c;
+
+	for (i = 0; i < n; i++) {
+		c = ecalloc(1, sizeof(Client));
+		c->win = 0x1000000 + i;
+		c->namelen = snprintf(c->name, sizeof c->name,
+			"client %d - \"quoted\" \\path\\ \ttab", i);
+		c->w = 1920;
+		c->h = 1080;
+		c->isfloating = i % 7 == 0;
+		c->next = mon.clients;
+		mon.clients = c;
+	}
+
+	us = bench(getclients, rounds, &len);
+	printf("getclients: %d clients, %zu bytes, %.1f us\n", n, len, us);
+	us = bench(statedump, rounds, &len);
+	cap = reply.cap;
+	printf("statedump:  %d clients, %zu bytes, %.1f us\n", n, len, us);
+	bench(statedump, rounds, &len);
+	printf("reply buffer %s after warm-up (%zu bytes)\n",
+		reply.cap == cap ? "did not grow" : "grew", reply.cap);
+	return EXIT_SUCCESS;
+}
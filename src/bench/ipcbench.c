@@ -0,0 +1,408 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * ipcbench - load generator for the wm socket.
+ *
+ * Maps a number of windows for wm to manage, then keeps many binary
+ * protocol connections busy with GetClients, SelectClient and StateDump
+ * and reports throughput and latency percentiles. Meanwhile it measures
+ * how long an X event takes through wm: it renames a probe window and
+ * waits for the title event wm pushes to a subscriber. The probe runs
+ * once before the load (idle) and during it (loaded). Finally it prints
+ * wm's own per-handler latency from the Stats command.
+ *
+ * With -l, exits non-zero if the p99 of the requests or of the loaded
+ * probe exceeds the given microseconds, so releases can be gated on it.
+ *
+ * Run it against a wm in a headless X server, see scripts/bench_ipc.sh.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include "../common/util.h"
+#include "../wm/ipc.h"
+
+#define LENGTH(X)		(sizeof X / sizeof X[0])
+#define SOCKET_PATH		"/tmp/xwm"
+#define MAXCONNS		62	/* wm serves 64, less the subscriber and a textreq() */
+#define PROBEMS			10	/* pause between two X event probes */
+
+typedef struct {
+	long long *v;
+	size_t n, cap;
+} Samples;
+
+typedef struct {
+	int fd;
+	int op;			/* of the request in flight, -1 if idle */
+	long long sent;		/* when it was sent or due, us */
+	long long next;		/* when the next request is due, us */
+	char *buf;
+	size_t len, cap;	/* reply read so far */
+} Conn;
+
+/* function declarations */
+static void add(Samples *s, long long v);
+static int connectwm(void);
+static void connread(Conn *c);
+static void connsend(Conn *c);
+static Window mapwindow(const char *name);
+static long long now(void);
+static long long percentile(Samples *s, double p);
+static void probe(void);
+static void probeline(char *line);
+static void report(const char *name, Samples *s);
+static void run(long long until, int load);
+static char *textreq(const char *req);
+static void usage(void);
+static void waitmanaged(int n);
+
+/* variables */
+static const struct { const char *name; int op; } ops[] = {
+	{ "GetClients",   GetClients },
+	{ "SelectClient", SelectClient },
+	{ "StateDump",    StateDump },
+};
+static int weight[LENGTH(ops)] = { 4, 1, 1 };
+static Samples lat[LENGTH(ops)], xidle, xload, *xcur;
+static Conn conns[MAXCONNS];
+static int nconns = 16, rate, limit;
+static Display *dpy;
+static Window *wins, probewin;
+static int nwins = 100;
+static int subfd;		/* text subscription to title events */
+static char subbuf[4096];
+static size_t sublen;
+static long long probesent;	/* when the outstanding probe was sent, 0 if none */
+static long long probenext;
+static unsigned long probeseq;
+
+void
+add(Samples *s, long long v)
+{
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		if (!(s->v = realloc(s->v, s->cap * sizeof *s->v)))
+			die("realloc:");
+	}
+	s->v[s->n++] = v;
+}
+
+int
+connectwm(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die("socket:");
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("connect %s:", SOCKET_PATH);
+	return fd;
+}
+
+/* connread() - Reads reply bytes, records the latency once a reply is complete. */
+void
+connread(Conn *c)
+{
+	IpcHeader h;
+	ssize_t n;
+
+	if (c->len == c->cap) {
+		c->cap = c->cap ? c->cap * 2 : 65536;
+		if (!(c->buf = realloc(c->buf, c->cap)))
+			die("realloc:");
+	}
+	if ((n = read(c->fd, c->buf + c->len, c->cap - c->len)) <= 0)
+		die("wm closed the connection");
+	c->len += n;
+	if (c->len < sizeof h)
+		return;
+	memcpy(&h, c->buf, sizeof h);
+	if (c->len < sizeof h + h.len)
+		return;
+	if (h.status != IpcOk)
+		die("%s failed with status %d", ops[c->op].name, h.status);
+	add(&lat[c->op], now() - c->sent);
+	c->len = 0;
+	c->op = -1;
+}
+
+/* connsend() - Sends the next request, picked by weight. */
+void
+connsend(Conn *c)
+{
+	char body[32];
+	IpcHeader h = { IPC_MAGIC, IPC_VERSION, 0, 0, 0, 0 };
+	int i, r, total = 0;
+
+	for (i = 0; i < LENGTH(ops); i++)
+		total += weight[i];
+	r = rand() % total;
+	for (i = 0; r >= weight[i]; r -= weight[i++]);
+	c->op = i;
+	h.op = ops[i].op;
+	if (h.op == SelectClient)
+		h.len = snprintf(body, sizeof body, "0x%lx", wins[rand() % nwins]);
+	/* rate limited requests count from when they were due, so a slow wm
+	 * cannot hide its backlog by delaying the next send */
+	c->sent = rate && c->next ? c->next : now();
+	if (write(c->fd, &h, sizeof h) != sizeof h || write(c->fd, body, h.len) != h.len)
+		die("write:");
+	c->next = rate ? c->sent + 1000000 / rate : 0;
+}
+
+Window
+mapwindow(const char *name)
+{
+	Window w;
+
+	w = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, 100, 100, 0, 0, 0);
+	XStoreName(dpy, w, name);
+	XMapWindow(dpy, w);
+	return w;
+}
+
+long long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+long long
+percentile(Samples *s, double p)
+{
+	size_t i;
+
+	if (!s->n)
+		return 0;
+	i = (size_t)(p * s->n + 0.999999);
+	return s->v[i ? i - 1 : 0];
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* probe() - Renames the probe window; wm answers with a title event. */
+void
+probe(void)
+{
+	char name[64];
+
+	snprintf(name, sizeof name, "probe %lu", ++probeseq);
+	XStoreName(dpy, probewin, name);
+	XFlush(dpy);
+	probesent = now();
+}
+
+void
+probeline(char *line)
+{
+	char want[96];
+
+	snprintf(want, sizeof want, "title 0x%lx probe %lu", probewin, probeseq);
+	if (probesent && !strcmp(line, want)) {
+		add(xcur, now() - probesent);
+		probesent = 0;
+		probenext = now() + PROBEMS * 1000;
+	}
+}
+
+void
+report(const char *name, Samples *s)
+{
+	qsort(s->v, s->n, sizeof *s->v, cmp);
+	printf("  %-13s %8zu %8lld %8lld %8lld %8lld\n", name, s->n,
+		percentile(s, 0.50), percentile(s, 0.99), percentile(s, 0.999),
+		s->n ? s->v[s->n - 1] : 0);
+}
+
+/* run() - Drives the probe, and the connections if load is set, until the deadline. */
+void
+run(long long until, int load)
+{
+	struct pollfd fds[MAXCONNS + 1];
+	long long t, wait;
+	char *nl;
+	ssize_t n;
+	int i;
+
+	while ((t = now()) < until) {
+		if (!probesent && t >= probenext)
+			probe();
+		wait = probesent ? until - t : MIN(probenext, until) - t;
+		fds[0].fd = subfd;
+		fds[0].events = POLLIN;
+		for (i = 0; load && i < nconns; i++) {
+			if (conns[i].op < 0 && conns[i].next <= t)
+				connsend(&conns[i]);
+			if (conns[i].op < 0)
+				wait = MIN(wait, conns[i].next - t);
+			fds[i + 1].fd = conns[i].fd;
+			fds[i + 1].events = conns[i].op >= 0 ? POLLIN : 0;
+		}
+		if (poll(fds, load ? nconns + 1 : 1, MAX(wait / 1000, 0)) < 0 && errno != EINTR)
+			die("poll:");
+		for (i = 0; load && i < nconns; i++)
+			if (fds[i + 1].revents & POLLIN)
+				connread(&conns[i]);
+		if (!(fds[0].revents & POLLIN))
+			continue;
+		if ((n = read(subfd, subbuf + sublen, sizeof subbuf - sublen - 1)) <= 0)
+			die("wm closed the subscription");
+		sublen += n;
+		subbuf[sublen] = '\0';
+		while ((nl = strchr(subbuf, '\n'))) {
+			*nl = '\0';
+			probeline(subbuf);
+			sublen -= nl + 1 - subbuf;
+			memmove(subbuf, nl + 1, sublen + 1);
+		}
+	}
+}
+
+/* textreq() - Sends one text protocol request and returns the whole reply. */
+char *
+textreq(const char *req)
+{
+	static char buf[1 << 20];
+	size_t len = 0, n = strlen(req);
+	ssize_t r;
+	int fd = connectwm();
+
+	if (write(fd, req, n) != (ssize_t)n)
+		die("write:");
+	while (len < sizeof buf - 1 && (r = read(fd, buf + len, sizeof buf - 1 - len)) > 0)
+		len += r;
+	buf[len] = '\0';
+	close(fd);
+	return buf;
+}
+
+void
+usage(void)
+{
+	die("usage: ipcbench [-c connections] [-r requests/s per connection, 0 = flat out]\n"
+	    "                [-d seconds] [-n windows] [-w getclients,select,dump weights]\n"
+	    "                [-l p99 limit in us]");
+}
+
+/* waitmanaged() - Waits until wm reports at least n clients. */
+void
+waitmanaged(int n)
+{
+	long long until = now() + 10000000;
+	char *p;
+	int lines;
+
+	do {
+		for (lines = 0, p = textreq("0\n"); (p = strchr(p, '\n')); p++)
+			lines++;
+		if (lines >= n)
+			return;
+		usleep(50000);
+	} while (now() < until);
+	die("wm manages only %d of %d windows", lines, n);
+}
+
+int
+main(int argc, char *argv[])
+{
+	long long start, end;
+	Samples all = { 0 };
+	int i, secs = 10;
+	char name[32];
+	size_t j;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 == argc)
+			usage();
+		if (!strcmp(argv[i], "-c"))
+			nconns = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r"))
+			rate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-d"))
+			secs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-l"))
+			limit = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n"))
+			nwins = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-w")) {
+			if (sscanf(argv[++i], "%d,%d,%d", &weight[0], &weight[1], &weight[2]) != 3
+			|| weight[0] + weight[1] + weight[2] <= 0)
+				usage();
+		} else
+			usage();
+	}
+	if (nconns < 1 || nconns > MAXCONNS || nwins < 1 || secs < 1)
+		usage();
+
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("ipcbench: cannot open display");
+	wins = ecalloc(nwins, sizeof *wins);
+	for (i = 0; i < nwins; i++) {
+		snprintf(name, sizeof name, "ipcbench %d", i);
+		wins[i] = mapwindow(name);
+	}
+	probewin = mapwindow("probe 0");
+	XSync(dpy, False);
+	waitmanaged(nwins + 1);
+
+	subfd = connectwm();
+	if (write(subfd, "6\ntitle\n", 8) != 8)
+		die("write:");
+	for (i = 0; i < nconns; i++) {
+		conns[i].fd = connectwm();
+		conns[i].op = -1;
+	}
+	textreq("4\nreset\n");
+
+	xcur = &xidle;
+	run(now() + 2000000, 0);
+	xcur = &xload;
+	start = now();
+	run(start + secs * 1000000LL, 1);
+	end = now();
+
+	printf("ipc: %d connections, %d windows, %s, %.1f s\n", nconns, nwins,
+		rate ? "rate limited" : "flat out", (end - start) / 1e6);
+	printf("  %-13s %8s %8s %8s %8s %8s\n", "op", "count", "p50_us", "p99_us", "p999_us", "max_us");
+	for (i = 0; i < LENGTH(ops); i++) {
+		for (j = 0; j < lat[i].n; j++)
+			add(&all, lat[i].v[j]);
+		report(ops[i].name, &lat[i]);
+	}
+	report("all", &all);
+	printf("  throughput: %.0f requests/s\n", all.n / ((end - start) / 1e6));
+	printf("x event latency (rename -> title event):\n");
+	report("idle", &xidle);
+	report("ipc saturated", &xload);
+	printf("wm handler latency:\n%s", textreq("4\n"));
+	XCloseDisplay(dpy);
+	if (limit && (percentile(&all, 0.99) > limit || percentile(&xload, 0.99) > limit)) {
+		fprintf(stderr, "ipcbench: p99 above %d us\n", limit);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
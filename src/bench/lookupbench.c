@@ -0,0 +1,72 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * lookupbench - shows that resolving an event's window stays flat as the
+ * number of managed windows grows. wm.c is built into this file so that
+ * wintoclient() can be called without a display; the clients are
+ * fabricated with XIDs spread over resource bases the way the server
+ * hands them out to many X clients. Half of the lookups miss, like the
+ * events on the bar, frames and override-redirect windows.
+ *
+ * For comparison it also times the list walk wintoclient() used before
+ * clients were indexed.
+ *
+ * usage: lookupbench [lookups]
+ */
+#define main wmmain
+#include "../wm/wm.c"
+#undef main
+
+static Client *
+walkclients(Window w)
+{
+	Client *c;
+
+	for (c = mon.clients; c; c = c->next)
+		if (c->win == w)
+			return c;
+	return NULL;
+}
+
+/* Returns the ns per lookup of n windows, every other one unmanaged. */
+static double
+bench(Client *(*lookup)(Window), Window *wins, int nwins, int n)
+{
+	struct timespec a, b;
+	volatile unsigned long hits = 0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	for (i = 0; i < n; i++)
+		hits += lookup(wins[(i * 7919UL) % nwins] + (i & 1)) != NULL;
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	return ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec)) / n;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const int counts[] = { 10, 100, 500, 1000, 5000 };
+	int i, j, nclients = 0, n = argc > 1 ? atoi(argv[1]) : 1000000;
+	Window *wins;
+	Client *c;
+
+	wins = ecalloc(counts[LENGTH(counts) - 1], sizeof(Window));
+	printf("%8s %12s %12s\n", "clients", "indexed ns", "walk ns");
+	for (i = 0; i < LENGTH(counts); i++) {
+		for (; nclients < counts[i]; nclients++) {
+			c = ecalloc(1, sizeof(Client));
+			/* a resource base per X client, windows 2 apart within it */
+			c->win = wins[nclients] = ((nclients / 4 + 1) << 21) + 0x3 + (nclients % 4) * 2;
+			c->next = mon.clients;
+			mon.clients = c;
+			hashclient(c);
+		}
+		printf("%8d %12.1f %12.1f\n", nclients,
+			bench(wintoclient, wins, nclients, n),
+			bench(walkclients, wins, nclients, n / (nclients / 10 + 1)));
+		for (j = 0; j < nclients; j++)
+			if (wintoclient(wins[j]) != walkclients(wins[j]))
+				die("lookupbench: index and list disagree on 0x%lx", wins[j]);
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,7 +1,11 @@
 /* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
 
@@ -10,6 +14,25 @@
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
+#define LENGTH(X)   (sizeof (X) / sizeof (X)[0])
+#define HASH(C)     ((size_t)(C) * 2654435761u)
+
+/* A fontconfig lookup for a codepoint none of the loaded fonts has */
+typedef struct FontJob {
+	FcChar32 codepoint;
+	FcPattern *pattern;	/* what to look for, then the match or NULL */
+	struct FontJob *next;
+} FontJob;
+
+/* Runs fallback lookups off the render path, see xfont_request() */
+struct FontWorker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	FontJob *todo, **todotail, *done;
+	int pipe[2];		/* a byte per finished lookup */
+	int started, quit;
+};
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
@@ -64,6 +87,7 @@ Drw *
 drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h)
 {
 	Drw *drw = ecalloc(1, sizeof(Drw));
+	int i;
 
 	drw->dpy = dpy;
 	drw->screen = screen;
@@ -73,6 +97,16 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
+	drw->fw = ecalloc(1, sizeof(FontWorker));
+	drw->fw->todotail = &drw->fw->todo;
+	pthread_mutex_init(&drw->fw->lock, NULL);
+	pthread_cond_init(&drw->fw->cond, NULL);
+	if (pipe(drw->fw->pipe) < 0)
+		die("pipe:");
+	for (i = 0; i < 2; i++) {
+		fcntl(drw->fw->pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl(drw->fw->pipe[i], F_SETFD, FD_CLOEXEC);
+	}
 
 	return drw;
 }
@@ -85,6 +119,11 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 
 	drw->w = w;
 	drw->h = h;
+	if (drw->xftdraw) {
+		/* drw_text() creates it again for the new pixmap */
+		XftDrawDestroy(drw->xftdraw);
+		drw->xftdraw = NULL;
+	}
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
@@ -93,9 +132,38 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 void
 drw_free(Drw *drw)
 {
+	FontWorker *fw = drw->fw;
+	FontJob *job, *next;
+
+	pthread_mutex_lock(&fw->lock);
+	fw->quit = 1;
+	pthread_cond_signal(&fw->cond);
+	pthread_mutex_unlock(&fw->lock);
+	if (fw->started)
+		pthread_join(fw->thread, NULL);
+	for (job = fw->todo; job; job = next) {
+		next = job->next;
+		FcPatternDestroy(job->pattern);
+		free(job);
+	}
+	for (job = fw->done; job; job = next) {
+		next = job->next;
+		if (job->pattern)
+			FcPatternDestroy(job->pattern);
+		free(job);
+	}
+	close(fw->pipe[0]);
+	close(fw->pipe[1]);
+	pthread_mutex_destroy(&fw->lock);
+	pthread_cond_destroy(&fw->cond);
+	free(fw);
+	if (drw->xftdraw)
+		XftDrawDestroy(drw->xftdraw);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	drw_fontset_free(drw->fonts);
+	free(drw->restab);
+	free(drw->specs);
 	free(drw);
 }
 
@@ -108,6 +176,7 @@ xfont_create(Drw *drw, const char *fontname, FcPattern *fontpattern)
 	Fnt *font;
 	XftFont *xfont = NULL;
 	FcPattern *pattern = NULL;
+	size_t i;
 
 	if (fontname) {
 		/* Using the pattern found at font->xfont->pattern does not yield the
@@ -134,6 +203,8 @@ xfont_create(Drw *drw, const char *fontname, FcPattern *fontpattern)
 	}
 
 	font = ecalloc(1, sizeof(Fnt));
+	for (i = 0; i < LENGTH(font->glyphs); i++)
+		font->glyphs[i].adv = -1;
 	font->xfont = xfont;
 	font->pattern = pattern;
 	font->h = xfont->ascent + xfont->descent;
@@ -150,9 +221,230 @@ xfont_free(Fnt *font)
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
+	free(font->glyphtab);
 	free(font);
 }
 
+/* Stores the glyph of a codepoint above U+00FF, growing the table to
+ * stay at most half full. */
+static void
+xfont_glyphstore(Fnt *font, FcChar32 c, FntGlyph g)
+{
+	GlyphSlot *old = font->glyphtab;
+	size_t i, j, oldcap = font->glyphcap;
+
+	if (2 * (font->glyphlen + 1) > font->glyphcap) {
+		font->glyphcap = oldcap ? oldcap * 2 : 256;
+		font->glyphtab = ecalloc(font->glyphcap, sizeof(GlyphSlot));
+		font->glyphlen = 0;
+		for (j = 0; j < oldcap; j++)
+			if (old[j].codepoint)
+				xfont_glyphstore(font, old[j].codepoint, old[j].glyph);
+		free(old);
+	}
+	for (i = HASH(c) & (font->glyphcap - 1); font->glyphtab[i].codepoint; i = (i + 1) & (font->glyphcap - 1))
+		;
+	font->glyphtab[i].codepoint = c;
+	font->glyphtab[i].glyph = g;
+	font->glyphlen++;
+}
+
+/* Returns the glyph index and advance of codepoint c in font; each
+ * codepoint is looked up by Xft only once, later string widths are
+ * table sums. */
+static FntGlyph
+xfont_glyph(Fnt *font, long c)
+{
+	XGlyphInfo ext;
+	FntGlyph g;
+	size_t i;
+
+	if (c < (long)LENGTH(font->glyphs) && font->glyphs[c].adv >= 0)
+		return font->glyphs[c];
+	for (i = font->glyphcap ? HASH(c) & (font->glyphcap - 1) : 0;
+	     c >= (long)LENGTH(font->glyphs) && font->glyphcap && font->glyphtab[i].codepoint;
+	     i = (i + 1) & (font->glyphcap - 1))
+		if (font->glyphtab[i].codepoint == (FcChar32)c)
+			return font->glyphtab[i].glyph;
+	g.index = XftCharIndex(font->dpy, font->xfont, c);
+	XftGlyphExtents(font->dpy, font->xfont, &g.index, 1, &ext);
+	g.adv = ext.xOff;
+	if (c < (long)LENGTH(font->glyphs))
+		font->glyphs[c] = g;
+	else
+		xfont_glyphstore(font, c, g);
+	return g;
+}
+
+/* Looks codepoint c up in the resolution table, NULL if it is not there. */
+static Res *
+xfont_reslookup(Drw *drw, FcChar32 c)
+{
+	size_t i;
+
+	if (!drw->rescap)
+		return NULL;
+	for (i = HASH(c) & (drw->rescap - 1); drw->restab[i].codepoint; i = (i + 1) & (drw->rescap - 1))
+		if (drw->restab[i].codepoint == c)
+			return &drw->restab[i];
+	return NULL;
+}
+
+/* Stores the font of codepoint c, growing the table to stay at most half full. */
+static Res *
+xfont_resstore(Drw *drw, FcChar32 c, Fnt *font)
+{
+	Res *old = drw->restab;
+	size_t i, j, oldcap = drw->rescap;
+
+	if (2 * (drw->reslen + 1) > drw->rescap) {
+		drw->rescap = oldcap ? oldcap * 2 : 1024;
+		drw->restab = ecalloc(drw->rescap, sizeof(Res));
+		drw->reslen = 0;
+		for (j = 0; j < oldcap; j++)
+			if (old[j].codepoint)
+				xfont_resstore(drw, old[j].codepoint, old[j].font)->pending = old[j].pending;
+		free(old);
+	}
+	for (i = HASH(c) & (drw->rescap - 1); drw->restab[i].codepoint; i = (i + 1) & (drw->rescap - 1))
+		;
+	drw->restab[i].codepoint = c;
+	drw->restab[i].font = font;
+	drw->restab[i].pending = 0;
+	drw->reslen++;
+	return &drw->restab[i];
+}
+
+/* Looks up fallback fonts. This is fontconfig only, no Xlib: the match is
+ * opened on the main thread by drw_fontset_poll(). */
+static void *
+xfont_worker(void *arg)
+{
+	FontWorker *fw = arg;
+	FontJob *job;
+	FcPattern *match;
+	FcResult result;
+
+	pthread_mutex_lock(&fw->lock);
+	while (1) {
+		while (!fw->todo && !fw->quit)
+			pthread_cond_wait(&fw->cond, &fw->lock);
+		if (fw->quit)
+			break;
+		job = fw->todo;
+		if (!(fw->todo = job->next))
+			fw->todotail = &fw->todo;
+		pthread_mutex_unlock(&fw->lock);
+
+		FcConfigSubstitute(NULL, job->pattern, FcMatchPattern);
+		FcDefaultSubstitute(job->pattern);
+		match = FcFontMatch(NULL, job->pattern, &result);
+		FcPatternDestroy(job->pattern);
+		job->pattern = match;
+
+		pthread_mutex_lock(&fw->lock);
+		job->next = fw->done;
+		fw->done = job;
+		/* a full pipe already wakes the main thread */
+		if (write(fw->pipe[1], "", 1) < 0)
+			;
+	}
+	pthread_mutex_unlock(&fw->lock);
+	return NULL;
+}
+
+/* Queues a fontconfig lookup for codepoint c, which none of the set has. */
+static void
+xfont_request(Drw *drw, long c)
+{
+	FontWorker *fw = drw->fw;
+	FcCharSet *fccharset;
+	FontJob *job;
+	sigset_t all, old;
+
+	if (!drw->fonts->pattern) {
+		/* Refer to the comment in xfont_create for more information. */
+		die("the first font in the cache must be loaded from a font string.");
+	}
+
+	job = ecalloc(1, sizeof(FontJob));
+	job->codepoint = c;
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, c);
+	job->pattern = FcPatternDuplicate(drw->fonts->pattern);
+	FcPatternAddCharSet(job->pattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(job->pattern, FC_SCALABLE, FcTrue);
+	FcCharSetDestroy(fccharset);
+
+	pthread_mutex_lock(&fw->lock);
+	if (!fw->started) {
+		/* signals, e.g. wm's watchdog SIGALRM, stay with the main thread */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		if (pthread_create(&fw->thread, NULL, xfont_worker, fw))
+			die("pthread_create:");
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		fw->started = 1;
+	}
+	*fw->todotail = job;
+	fw->todotail = &job->next;
+	pthread_cond_signal(&fw->cond);
+	pthread_mutex_unlock(&fw->lock);
+}
+
+/* Appends a fallback font to the set and resolves the codepoints it covers
+ * that had no font so far. */
+static void
+xfont_append(Drw *drw, Fnt *font)
+{
+	Fnt *last;
+	size_t i;
+
+	for (last = drw->fonts; last->next; last = last->next)
+		; /* NOP */
+	last->next = font;
+	for (i = 0; i < drw->rescap; i++)
+		if (drw->restab[i].codepoint && !drw->restab[i].font
+		&& XftCharExists(drw->dpy, font->xfont, drw->restab[i].codepoint)) {
+			drw->restab[i].font = font;
+			drw->restab[i].pending = 0;
+		}
+}
+
+/* Returns the font that draws codepoint c: the first of the set that has
+ * it, else the primary font, which draws the missing-glyph box. In the
+ * latter case fontconfig is asked for a fallback in the background. Both
+ * outcomes are remembered, so the set is only walked and fontconfig only
+ * asked once per codepoint. */
+static Fnt *
+xfont_resolve(Drw *drw, long c)
+{
+	Res *r;
+	Fnt *font;
+
+	if ((r = xfont_reslookup(drw, c)))
+		return r->font ? r->font : drw->fonts;
+	for (font = drw->fonts; font; font = font->next)
+		if (XftCharExists(drw->dpy, font->xfont, c))
+			break;
+	r = xfont_resstore(drw, c, font);
+	if (font)
+		return font;
+	r->pending = 1;
+	xfont_request(drw, c);
+	return drw->fonts;
+}
+
+/* Forgets all resolved codepoints, for when the font set changes. */
+static void
+xfont_resclear(Drw *drw)
+{
+	if (drw->restab)
+		memset(drw->restab, 0, drw->rescap * sizeof(Res));
+	drw->reslen = 0;
+	drw->asciiprimary = 0;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -168,6 +460,7 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 			ret = cur;
 		}
 	}
+	xfont_resclear(drw);
 	return (drw->fonts = ret);
 }
 
@@ -180,6 +473,66 @@ drw_fontset_free(Fnt *font)
 	}
 }
 
+int
+drw_fontset_fd(Drw *drw)
+{
+	return drw ? drw->fw->pipe[0] : -1;
+}
+
+/* Opens the fallback fonts the worker found since the last call and adds
+ * them to the set. Returns 1 if text drawn since then looks different now. */
+int
+drw_fontset_poll(Drw *drw)
+{
+	FontWorker *fw = drw->fw;
+	FontJob *job, *next, **pp;
+	Res *r;
+	Fnt *font;
+	char buf[64];
+	int redraw = 0;
+
+	while (read(fw->pipe[0], buf, sizeof(buf)) > 0)
+		;
+	pthread_mutex_lock(&fw->lock);
+	job = fw->done;
+	fw->done = NULL;
+	pthread_mutex_unlock(&fw->lock);
+	for (; job; job = next) {
+		next = job->next;
+		font = NULL;
+		/* an earlier fallback may have covered it meanwhile */
+		r = xfont_reslookup(drw, job->codepoint);
+		if (!r || !r->pending) {
+			if (job->pattern)
+				FcPatternDestroy(job->pattern);
+		} else if (job->pattern && (font = xfont_create(drw, NULL, job->pattern))
+		&& XftCharExists(drw->dpy, font->xfont, job->codepoint)) {
+			xfont_append(drw, font);
+			redraw = 1;
+		} else {
+			xfont_free(font);
+			r->pending = 0;
+		}
+		free(job);
+	}
+	if (!redraw)
+		return 0;
+	/* queued lookups for codepoints the new fonts have are moot */
+	pthread_mutex_lock(&fw->lock);
+	for (pp = &fw->todo; (job = *pp); ) {
+		if ((r = xfont_reslookup(drw, job->codepoint)) && !r->pending) {
+			*pp = job->next;
+			FcPatternDestroy(job->pattern);
+			free(job);
+		} else {
+			pp = &job->next;
+		}
+	}
+	fw->todotail = pp;
+	pthread_mutex_unlock(&fw->lock);
+	return 1;
+}
+
 void
 drw_clr_create(Drw *drw, Clr *dest, const char *clrname)
 {
@@ -212,8 +565,10 @@ drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount)
 void
 drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw)
+	if (drw && drw->fonts != set) {
+		xfont_resclear(drw);
 		drw->fonts = set;
+	}
 }
 
 void
@@ -235,25 +590,30 @@ drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
 }
 
+/* Queues glyph g of font at x for drw_text() to submit. */
+static void
+drw_spec(Drw *drw, size_t n, Fnt *font, FntGlyph g, int x, int y, unsigned int h)
+{
+	if (n == drw->specscap) {
+		drw->specscap = drw->specscap ? drw->specscap * 2 : 256;
+		if (!(drw->specs = realloc(drw->specs, drw->specscap * sizeof(XftGlyphFontSpec))))
+			die("realloc:");
+	}
+	drw->specs[n].font = font->xfont;
+	drw->specs[n].glyph = g.index;
+	drw->specs[n].x = x;
+	drw->specs[n].y = y + (h - font->h) / 2 + font->xfont->ascent;
+}
+
 int
 drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
 {
-	int i, ty, ellipsis_x = 0;
-	unsigned int tmpw, ew, ellipsis_w = 0, ellipsis_len;
-	XftDraw *d = NULL;
-	Fnt *usedfont, *curfont, *nextfont;
-	int utf8strlen, utf8charlen, render = x || y || w || h;
-	long utf8codepoint = 0;
-	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0, overflow = 0;
-	/* keep track of a couple codepoints for which we have no match. */
-	enum { nomatches_len = 64 };
-	static struct { long codepoint[nomatches_len]; unsigned int idx; } nomatches;
-	static unsigned int ellipsis_width = 0;
+	unsigned int ew = 0, ellipsis_w = 0;
+	int i, ascii, ellipsis_x = -1, render = x || y || w || h;
+	size_t n = 0, ellipsis_n = 0;
+	long utf8codepoint;
+	Fnt *font, *dotfont = NULL;
+	FntGlyph g, dot;
 
 	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
 		return 0;
@@ -263,125 +623,63 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	} else {
 		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
+		if (!drw->xftdraw)
+			drw->xftdraw = XftDrawCreate(drw->dpy, drw->drawable,
+			                             DefaultVisual(drw->dpy, drw->screen),
+			                             DefaultColormap(drw->dpy, drw->screen));
 		x += lpad;
 		w -= lpad;
 	}
 
-	usedfont = drw->fonts;
-	if (!ellipsis_width && render)
-		ellipsis_width = drw_fontset_getwidth(drw, "...");
-	while (1) {
-		ew = ellipsis_len = utf8strlen = 0;
-		utf8str = text;
-		nextfont = NULL;
-		while (*text) {
-			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					drw_font_getexts(curfont, text, utf8charlen, &tmpw, NULL);
-					if (ew + ellipsis_width <= w) {
-						/* keep track where the ellipsis still fits */
-						ellipsis_x = x + ew;
-						ellipsis_w = w - ew;
-						ellipsis_len = utf8strlen;
-					}
-
-					if (ew + tmpw > w) {
-						overflow = 1;
-						/* called from drw_fontset_getwidth_clamp():
-						 * it wants the width AFTER the overflow
-						 */
-						if (!render)
-							x += tmpw;
-						else
-							utf8strlen = ellipsis_len;
-					} else if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-						ew += tmpw;
-					} else {
-						nextfont = curfont;
-					}
-					break;
-				}
-			}
-
-			if (overflow || !charexists || nextfont)
-				break;
-			else
-				charexists = 0;
+	/* printable ASCII the primary font has needs no decoding or resolving,
+	 * told apart byte by byte in the loop below */
+	if (!drw->asciiprimary)
+		for (drw->asciiprimary = 1, i = 0x20; i <= 0x7e; i++)
+			if (!XftCharExists(drw->dpy, drw->fonts->xfont, i))
+				drw->asciiprimary = -1;
+	ascii = drw->asciiprimary > 0;
+
+	/* measuring never draws the ellipsis */
+	if (render) {
+		dotfont = xfont_resolve(drw, '.');
+		dot = xfont_glyph(dotfont, '.');
+		ellipsis_w = 3 * dot.adv;
+	}
+	for (font = drw->fonts; *text; text += i) {
+		if (ascii && BETWEEN(*text, 0x20, 0x7e)) {
+			utf8codepoint = *text;
+			font = drw->fonts;
+			i = 1;
+		} else {
+			i = utf8decode(text, &utf8codepoint, UTF_SIZ);
+			font = xfont_resolve(drw, utf8codepoint);
 		}
-
-		if (utf8strlen) {
-			if (render) {
-				ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-				XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-				                  usedfont->xfont, x, ty, (XftChar8 *)utf8str, utf8strlen);
-			}
-			x += ew;
-			w -= ew;
+		g = xfont_glyph(font, utf8codepoint);
+		if (render && ew + ellipsis_w <= w) {
+			/* keep track where the ellipsis still fits */
+			ellipsis_x = x + ew;
+			ellipsis_n = n;
 		}
-		if (render && overflow)
-			drw_text(drw, ellipsis_x, y, ellipsis_w, h, 0, "...", invert);
-
-		if (!*text || overflow) {
+		if (ew + g.adv > w) {
+			/* called from drw_fontset_getwidth_clamp():
+			 * it wants the width AFTER the overflow
+			 */
+			if (!render)
+				return ew + g.adv;
+			/* cut at the ellipsis, if it fits at all */
+			for (n = ellipsis_n, i = 0; ellipsis_x >= 0 && i < 3; i++)
+				drw_spec(drw, n++, dotfont, dot, ellipsis_x + i * dot.adv, y, h);
 			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
-		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1;
-
-			for (i = 0; i < nomatches_len; ++i) {
-				/* avoid calling XftFontMatch if we know we won't find a match */
-				if (utf8codepoint == nomatches.codepoint[i])
-					goto no_match;
-			}
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
-
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					nomatches.codepoint[++nomatches.idx % nomatches_len] = utf8codepoint;
-no_match:
-					usedfont = drw->fonts;
-				}
-			}
 		}
+		if (render)
+			drw_spec(drw, n++, font, g, x + ew, y, h);
+		ew += g.adv;
 	}
-	if (d)
-		XftDrawDestroy(d);
-
-	return x + (render ? w : 0);
+	if (!render)
+		return ew;
+	if (n)
+		XftDrawGlyphFontSpec(drw->xftdraw, &drw->scheme[invert ? ColBg : ColFg], drw->specs, n);
+	return x + w;
 }
 
 void
@@ -391,7 +689,6 @@ drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 		return;
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
 }
 
 void
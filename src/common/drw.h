@@ -4,14 +4,35 @@ typedef struct {
 	Cursor cursor;
 } Cur;
 
+typedef struct {
+	unsigned int index;	/* in the font, for XftDrawGlyphFontSpec() */
+	int adv;		/* -1 until measured */
+} FntGlyph;
+
+typedef struct {
+	FcChar32 codepoint;	/* 0 marks a free slot */
+	FntGlyph glyph;
+} GlyphSlot;
+
 typedef struct Fnt {
 	Display *dpy;
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
+	FntGlyph glyphs[256];	/* U+0000..U+00FF */
+	GlyphSlot *glyphtab;	/* the other codepoints, open addressing */
+	size_t glyphlen, glyphcap;
 	struct Fnt *next;
 } Fnt;
 
+typedef struct {
+	FcChar32 codepoint;	/* 0 marks a free slot */
+	Fnt *font;		/* NULL if no font has the glyph */
+	int pending;		/* font is NULL until a fallback lookup ends */
+} Res;
+
+typedef struct FontWorker FontWorker;
+
 enum { ColFg, ColBg, ColBorder }; /* Clr scheme index */
 typedef XftColor Clr;
 
@@ -21,9 +42,16 @@ typedef struct {
 	int screen;
 	Window root;
 	Drawable drawable;
+	XftDraw *xftdraw;	/* for drawable, created by the first drw_text() */
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	Res *restab;		/* codepoint to font of fonts, open addressing */
+	size_t reslen, rescap;
+	FontWorker *fw;		/* fallback font lookups, see drw_fontset_poll() */
+	int asciiprimary;	/* 1 if fonts has all of printable ASCII, -1 if not, 0 unknown */
+	XftGlyphFontSpec *specs;	/* glyphs drw_text() submits at once */
+	size_t specscap;
 } Drw;
 
 /* Drawable abstraction */
@@ -34,6 +62,8 @@ void drw_free(Drw *drw);
 /* Fnt abstraction */
 Fnt *drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
 void drw_fontset_free(Fnt* set);
+int drw_fontset_fd(Drw *drw);
+int drw_fontset_poll(Drw *drw);
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 unsigned int drw_fontset_getwidth_clamp(Drw *drw, const char *text, unsigned int n);
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
@@ -367,12 +367,13 @@ unpress(Key *k, KeySym mod) {
 void
 run(void) {
 	XEvent ev;
-	int xfd;
+	int xfd, ffd;
 	fd_set fds;
 	struct timeval tv;
 
 
 	xfd = ConnectionNumber(dpy);
+	ffd = drw_fontset_fd(drw);
 	tv.tv_usec = 0;
 	tv.tv_sec = 2;
 
@@ -382,7 +383,11 @@ run(void) {
 	while (running) {
 		FD_ZERO(&fds);
 		FD_SET(xfd, &fds);
-		if (select(xfd + 1, &fds, NULL, NULL, &tv)) {
+		FD_SET(ffd, &fds);
+		if (select(MAX(xfd, ffd) + 1, &fds, NULL, NULL, &tv)) {
+			/* labels drawn with a placeholder glyph get their font */
+			if (FD_ISSET(ffd, &fds) && drw_fontset_poll(drw))
+				drawkeyboard();
 			while (XPending(dpy)) {
 				XNextEvent(dpy, &ev);
 				if(handler[ev.type]) {
@@ -1,7 +1,9 @@
 /* See LICENSE file for copyright and license details. */
 
 #include <ctype.h>
+#include <errno.h>
 #include <locale.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -576,9 +578,24 @@ readstdin(void)
 static void
 run(void)
 {
+	struct pollfd fds[2];
 	XEvent ev;
 
-	while (!XNextEvent(dpy, &ev)) {
+	fds[0].fd = ConnectionNumber(dpy);
+	fds[0].events = POLLIN;
+	fds[1].fd = drw_fontset_fd(drw);
+	fds[1].events = POLLIN;
+	while (1) {
+		/* sleep until X has events or a fallback font was found */
+		if (!XPending(dpy)) {
+			if (poll(fds, 2, -1) < 0 && errno != EINTR)
+				die("poll:");
+			if (fds[1].revents & POLLIN && drw_fontset_poll(drw))
+				drawmenu();
+			continue;
+		}
+		if (XNextEvent(dpy, &ev))
+			break;
 		if (XFilterEvent(&ev, win))
 			continue;
 		switch(ev.type) {
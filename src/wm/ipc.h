@@ -0,0 +1,37 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * IPC protocol spoken on SOCKET_PATH, shared by wm and its clients.
+ *
+ * Text:   "op\npayload", one request per connection, or NUL terminated
+ *         requests and replies after KeepAlive.
+ * Binary: a connection whose first byte is IPC_MAGIC sends IpcHeader
+ *         framed requests; every reply carries the request's op and id.
+ *         Fields are in host byte order, both ends share the machine.
+ */
+
+#include <stdint.h>
+
+#define IPC_MAGIC	0xb7	/* >= 0x80, never the start of a text request */
+#define IPC_VERSION	1
+
+/* socket commands; clients are named by their window id, e.g. SelectClient "0x1a00003" */
+enum { GetClients, SelectClient, StateDump, Quit, Stats, KeepAlive, Subscribe, Batch };
+enum { IpcOk, IpcBadVersion, IpcBadOp, IpcNotFound }; /* IpcHeader.status of replies */
+
+typedef struct {
+	uint8_t magic;		/* IPC_MAGIC */
+	uint8_t version;	/* IPC_VERSION */
+	uint16_t op;		/* socket command */
+	uint32_t id;		/* chosen by the client, echoed in the reply */
+	uint32_t len;		/* payload bytes following the header */
+	int32_t status;		/* Ipc* in replies, 0 in requests */
+} IpcHeader;
+
+/* GetClients reply payload: one record per client, each followed by its name */
+typedef struct {
+	uint32_t win;
+	uint8_t floating, fixed, hidden, urgent;
+	uint16_t namelen;	/* name bytes following the record, no NUL */
+	uint16_t pad;
+} IpcClient;
@@ -0,0 +1,90 @@
+/* See LICENSE file for copyright and license details. */
+
+/*
+ * State snapshot wm publishes in the POSIX shared memory object SNAP_NAME.
+ * wm rewrites it whenever commit() applied changes; readers map it once
+ * and then read it without any system call:
+ *
+ *	const Snapshot *shm = snapopen();
+ *	Snapshot *s = malloc(sizeof *s);
+ *	if (shm && snapread(shm, s))
+ *		... s->focus, s->clients[0 .. s->nclients) ...
+ *
+ * seq is a seqlock: odd while wm writes, bumped by two per update.
+ */
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SNAP_NAME	"/xwm"
+#define SNAP_VERSION	1
+#define SNAP_MAXCLIENTS	512
+#define SNAP_RETRIES	1000	/* torn reads tolerated before snapread() gives up */
+
+typedef struct {
+	uint32_t win;
+	int32_t x, y, w, h;
+	uint8_t floating, fixed, hidden, urgent;
+	char name[256];
+} SnapClient;
+
+typedef struct {
+	uint32_t version;	/* SNAP_VERSION */
+	uint32_t seq;
+	uint32_t nclients;	/* entries in clients[], most recently focused first */
+	uint32_t total;		/* managed clients, more than nclients if they did not fit */
+	uint32_t focus;		/* window of the focused client, 0 if none */
+	int32_t showbar;
+	int32_t dock;		/* on-screen keyboard shown */
+	int32_t sw, sh;		/* screen size */
+	SnapClient clients[SNAP_MAXCLIENTS];
+} Snapshot;
+
+/* snapopen() - Maps the snapshot read-only, NULL if wm does not publish one. */
+static inline const Snapshot *
+snapopen(void)
+{
+	Snapshot *s;
+	int fd;
+
+	if ((fd = shm_open(SNAP_NAME, O_RDONLY, 0)) < 0)
+		return NULL;
+	s = mmap(NULL, sizeof(Snapshot), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED)
+		return NULL;
+	if (s->version != SNAP_VERSION) {
+		munmap(s, sizeof(Snapshot));
+		return NULL;
+	}
+	return s;
+}
+
+/*
+ * snapread() - Copies a consistent snapshot from shm to out.
+ * Only the used part of clients[] is copied. Returns 0 if wm kept
+ * writing for SNAP_RETRIES attempts.
+ */
+static inline int
+snapread(const Snapshot *shm, Snapshot *out)
+{
+	uint32_t seq, n;
+	int i;
+
+	for (i = 0; i < SNAP_RETRIES; i++) {
+		if ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1)
+			continue;
+		memcpy(out, shm, offsetof(Snapshot, clients));
+		n = out->nclients < SNAP_MAXCLIENTS ? out->nclients : SNAP_MAXCLIENTS;
+		memcpy(out->clients, shm->clients, n * sizeof(SnapClient));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) {
+			out->nclients = n;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -5,14 +5,22 @@
 #include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/un.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
@@ -24,6 +32,8 @@
 
 #include "../common/drw.h"
 #include "../common/util.h"
+#include "ipc.h"
+#include "snapshot.h"
 
 /* macros */
 #define BUTTONMASK		(ButtonPressMask|ButtonReleaseMask)
@@ -34,16 +44,33 @@
 #define HEIGHT(X)		((X)->h + 2 * (X)->bw)
 #define TEXTW(X)		(drw_fontset_getwidth(drw, (X)) + lrpad)
 #define SOCKET_PATH 		"/tmp/xwm"
+#define CLIENTBUCKETS		1024 /* size of the window to client index, power of two */
+#define HISTSUB			8    /* linear sub-buckets per power of two, see histrecord() */
+#define HISTBUCKETS		(HISTSUB * 30)
+#define EVENTBATCH		128  /* X events read and coalesced per drain cycle */
+#define CLIENTHASH(W)		((unsigned int)(((W) ^ ((W) >> 21)) * 2654435761u) & (CLIENTBUCKETS - 1))
 #define DELIMITER 		"\n"
+#define MAXCONNS		64   /* concurrent IPC connections */
+#define CONNBATCH		32   /* requests served per connection and loop iteration */
+#define MAXREQUEST		65536 /* bytes a request may take before the connection is dropped */
+#define MAXBACKLOG		65536 /* unsent bytes a subscriber may fall behind before it is dropped */
+#define MAXPENDING		65536 /* unsent reply bytes before a connection's requests wait */
+#define BATCHMAX		32   /* operations in one Batch request */
+#define IOVCHUNK		32   /* clients gathered per sendmsg() in sendclients() */
 
 /* enums */
 enum { CurNormal, CurResize, CurMove, CurLast }; /* cursor */
 enum { SchemeNorm, SchemeSel }; /* color schemes */
-enum { NetSupported, NetWMName, NetWMState, NetWMCheck,NetActiveWindow, NetWMWindowType,
+enum { NetSupported, NetWMName, NetWMState, NetWMStateHidden, NetWMCheck,NetActiveWindow, NetWMWindowType,
 	   NetWMWindowTypeDialog, NetWMWindowTypeDock, NetClientList, NetLast }; /* EWMH atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
 enum { ClkStatusText, ClkWinTitle, ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
-enum {GetClients, SelectClient, StateDump, Quit}; /* socket commands */
+enum { SubFocus, SubAdd, SubRemove, SubTitle, SubBar, SubDock, SubLast }; /* pushed to subscribers */
+enum { TimerBar, TimerLast }; /* deferred work, see schedule() */
+enum { SegStatus, SegTitle, SegLast }; /* bar segments, see drawbar() */
+enum { PayloadNone, PayloadOptional, PayloadRequired }; /* text requests, see connrequest() */
+enum { DirtyLayout = 1 << 0, DirtyStack = 1 << 1, DirtyBar = 1 << 2,
+       DirtyClientList = 1 << 3, DirtySnapshot = 1 << 4 }; /* work pending for commit() */
 
 typedef union {
 	int i;
@@ -64,16 +91,60 @@ typedef struct Monitor Monitor;
 typedef struct Client Client;
 struct Client {
 	char name[256];
+	int namelen;
 	float mina, maxa;
 	int x, y, w, h;
 	int oldx, oldy, oldw, oldh;
 	int basew, baseh, incw, inch, hintsvalid;
 	int bw, oldbw;
 	int isfixed, isfloating, isurgent, neverfocus;
+	int ishidden;		/* unmapped by the wm because another tiled client is on top */
+	int ignoreunmap;	/* UnmapNotify events caused by sethidden() still to come */
+	unsigned long unmapserial;	/* request serial of the first of them */
+	unsigned int geomgen;	/* mon.geomgen its tiled geometry was last applied for */
+	int stackpos;		/* index in the last committed stacking order, -1 if never stacked */
 	Client *next;
+	Client *hnext;		/* next client in the same clienttable bucket */
 	Window win;
 };
 
+typedef struct {
+	char *data;
+	size_t len, cap;	/* cap is kept across uses, see bufprintf() */
+} Buf;
+
+typedef struct {
+	char text[256];		/* what the segment shows, see barsegment() */
+	Clr *scm;
+	int x, w;
+	int flags;		/* segment specific state drawn next to the text */
+	int valid;
+} BarSeg;
+
+typedef struct {
+	unsigned long count;
+	unsigned long max;			/* slowest sample, microseconds */
+	unsigned int buckets[HISTBUCKETS];	/* log-linear, see histrecord() */
+} Histogram;
+
+typedef struct {
+	int fd;			/* -1 for a free slot */
+	int persistent;		/* KeepAlive: NUL framed requests and replies */
+	int binary;		/* IpcHeader framed requests and replies, see ipc.h */
+	int eof;		/* peer shut down its side */
+	int done;		/* close once wbuf is flushed */
+	int more;		/* CONNBATCH ran out, requests may be left in rbuf */
+	unsigned int subscribed; /* 1 << Sub* of the events pushed to it, see notify() */
+	char *rbuf, *wbuf;
+	size_t rlen, rcap;
+	size_t woff, wlen, wcap;
+} Conn;
+
+typedef struct {
+	long long when;		/* CLOCK_MONOTONIC deadline in ms, 0 when idle */
+	void (*func)(void);	/* NULL only wakes run() so commit() retries */
+} Timer;
+
 typedef struct {
 	unsigned int mod;
 	KeySym keysym;
@@ -85,6 +156,7 @@ struct Monitor {
 	int by;			/* bar geometry */
 	int mx, my, mw, mh;   	/* screen size */
 	int wx, wy, ww, wh;   	/* window area  */
+	unsigned int geomgen;	/* bumped whenever the window area changes */
 	int showbar;
 	Client *clients;
 	Window barwin;
@@ -94,17 +166,32 @@ struct Monitor {
 /* function declarations */
 static void arrange(void);
 static void attach(Client *c);
+static int barsegment(BarSeg *seg, const char *text, Clr *scm, int x, int w, int flags);
+static char* batch(char *body);
+static void bufjson(Buf *b, const char *s);
+static void bufprintf(Buf *b, const char *fmt, ...);
 static void buttonpress(XEvent *e);
 static void checkotherwm(void);
 static void cleanup(void);
 static void clientmessage(XEvent *e);
+static void coalesce(XEvent *evs, int n);
+static void commit(void);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
 static void createbar(void);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
-static void dispatchsocketevent();
+static int connbinary(Conn *c);
+static void connclose(Conn *c);
+static void connevent(Conn *c, short revents);
+static void connqueue(Conn *c, const void *data, size_t len);
+static int connrequest(Conn *c);
+static void connsend(Conn *c, struct iovec *iov, int n);
+static void connwrite(Conn *c);
+static void dispatchsocketevent(void);
+static void drainevents(void);
+static Window evwindow(XEvent *e);
 static void drawbar(void);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
@@ -118,42 +205,67 @@ static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
 static Atom getwindowtype(Window w);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
+static void hashclient(Client *c);
+static unsigned long histpercentile(const Histogram *h, double p);
+static void histrecord(Histogram *h, long long us);
+static void histwrite(Buf *b, const char *name, const Histogram *h, int first);
 static void keypress(XEvent *e);
+static char* keepalive(char *unused);
 static void killclient(const Arg *arg);
+static void killclientwin(Client *c);
+static void layout(void);
 static void manage(Window w, XWindowAttributes *wa);
+static long long monotonicms(void);
+static long long monotonicus(void);
 static void managedock(Window w, XWindowAttributes *wa);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
 static void movemouse(const Arg *arg);
+static void notify(int ev, const char *fmt, ...);
 static void propertynotify(XEvent *e);
 static char* quit(char* unused);
 static void resize(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void restack(void);
 static void run(void);
+static void runtimers(void);
 static void scan(void);
+static void schedule(int timer, long long ms);
 static int sendevent(Client *c, Atom proto);
 static char* selectclient(char *body);
+static void sendclients(Conn *c, IpcHeader *r);
 static void setclientstate(Client *c, long state);
+static void setfloating(Client *c, int floating);
 static void setfocus(Client *c);
+static void sethidden(Client *c, int hidden);
 static void setup(void);
+static void setupsnapshot(void);
 static void setupsocket(void);
 static void seturgent(Client *c, int urg);
 static void spawn(const Arg *arg);
 static char* statedump(char *unused);
+static char* stats(char *body);
+static char* subscribe(char *body);
+static double wakeuprate(void);
 static void togglebar(const Arg *arg);
 static void togglefloating(const Arg *arg);
 static void unfocus(Client *c, int setfocus);
+static void unhashclient(Client *c);
 static void unmanage(Client *c, int destroyed);
 static void unmapnotify(XEvent *e);
 static void updatebarpos(void);
 static void updateclientlist(void);
+static void updatesnapshot(void);
 static int updategeom(void);
 static void updatenumlockmask(void);
 static void updatestatus(void);
 static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
+static void watchbegin(const char *event, const char *handler, Window w, long long start);
+static void watchdog(int unused);
+static void watchend(void);
+static void watchset(long long us);
 static Client *wintoclient(Window w);
 static int xerror(Display *dpy, XErrorEvent *ee);
 static int xerrordummy(Display *dpy, XErrorEvent *ee);
@@ -168,11 +280,39 @@ static int bh;			   /* bar height */
 static int lrpad;			/* sum of left and right padding for text */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int numlockmask = 0;
-static char* (*shandler[4]) (char *) = {
+static char* (*shandler[]) (char *) = {
 	[GetClients] = getclients,
 	[SelectClient] = selectclient, 
 	[StateDump] = statedump,
-	[Quit] = quit
+	[Quit] = quit,
+	[Stats] = stats,
+	[KeepAlive] = keepalive,
+	[Subscribe] = subscribe,
+	[Batch] = batch
+};
+static const char *sname[LENGTH(shandler)] = {
+	[GetClients] = "GetClients",
+	[SelectClient] = "SelectClient",
+	[StateDump] = "StateDump",
+	[Quit] = "Quit",
+	[Stats] = "Stats",
+	[KeepAlive] = "KeepAlive",
+	[Subscribe] = "Subscribe",
+	[Batch] = "Batch"
+};
+static const int spayload[LENGTH(shandler)] = {
+	[SelectClient] = PayloadRequired,
+	[Stats] = PayloadOptional,
+	[Subscribe] = PayloadOptional,
+	[Batch] = PayloadRequired
+};
+static const char *subname[SubLast] = {
+	[SubFocus] = "focus",
+	[SubAdd] = "add",
+	[SubRemove] = "remove",
+	[SubTitle] = "title",
+	[SubBar] = "bar",
+	[SubDock] = "dock"
 };
 static void (*xhandler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
@@ -189,71 +329,70 @@ static void (*xhandler[LASTEvent]) (XEvent *) = {
 	[PropertyNotify] = propertynotify,
 	[UnmapNotify] = unmapnotify
 };
+static const struct { const char *event, *handler; } xname[LASTEvent] = {
+	[ButtonPress] = { "ButtonPress", "buttonpress" },
+	[ClientMessage] = { "ClientMessage", "clientmessage" },
+	[ConfigureRequest] = { "ConfigureRequest", "configurerequest" },
+	[ConfigureNotify] = { "ConfigureNotify", "configurenotify" },
+	[DestroyNotify] = { "DestroyNotify", "destroynotify" },
+	[EnterNotify] = { "EnterNotify", "enternotify" },
+	[Expose] = { "Expose", "expose" },
+	[FocusIn] = { "FocusIn", "focusin" },
+	[KeyPress] = { "KeyPress", "keypress" },
+	[MappingNotify] = { "MappingNotify", "mappingnotify" },
+	[MapRequest] = { "MapRequest", "maprequest" },
+	[PropertyNotify] = { "PropertyNotify", "propertynotify" },
+	[UnmapNotify] = { "UnmapNotify", "unmapnotify" }
+};
+static Histogram xhist[LASTEvent], shist[LENGTH(shandler)]; /* handler latency */
+static volatile struct {
+	sig_atomic_t active;	/* a handler runs, the other fields are valid */
+	unsigned long seq;	/* dispatches so far, identifies the current one */
+	long long start;	/* monotonicus() when the handler was entered */
+	const char *event, *handler;
+	Window win;
+} dispatch;		/* what the main loop runs right now, see watchdog() */
+static volatile unsigned long stallseq;	/* last dispatch watchdog() reported */
+static volatile sig_atomic_t stalls;	/* dispatches that exceeded stallbudget */
 static Atom wmatom[WMLast], netatom[NetLast];
 static int running = 1;
+static unsigned int dirty; /* Dirty* flags, applied once per loop by commit() */
+static unsigned long evreceived, evcoalesced, evdispatched; /* drainevents() counters */
 static int sockfd;
+static Conn conns[MAXCONNS];	/* IPC connections, see dispatchsocketevent() */
+static int nconns;
+static Conn *ipcconn;		/* connection whose request is being handled */
+static Buf reply;		/* socket handler output, valid until the next request */
+static int nsubscribers;
+static Window focuswin;		/* last focus announced to subscribers */
+static int timerfd;
+static Snapshot *snapshot;	/* shared with readers, see snapshot.h */
+static long long timerarmed;	/* deadline timerfd is armed for, 0 if disarmed */
+static long long lastbar;	/* when drawbar() last ran, see barinterval */
+static unsigned long wakeups;	/* poll() returns in run() */
+static Timer timers[TimerLast];
+static BarSeg barseg[SegLast];	/* what the bar pixmap currently holds */
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
 static Drw *drw;
 static Monitor mon;
+static Client *clienttable[CLIENTBUCKETS]; /* window to client index, see wintoclient() */
 static Window root, wmcheckwin;
 
 /* configuration, allows nested code to access above variables */
 #include "wm.h"
 
 /*
- * arrange() - This function orchestrates the layout updates for client windows.
- * It is a critical part of the window manager's main event loop, ensuring that
- * the arrangement of windows reflects both the current screen geometry and client
- * states. This design prioritizes responsiveness by keeping the layout recalculations
- * lightweight, which is essential for smooth user interactions.
+ * arrange() - Schedules a full layout update for the client windows.
+ * Handlers call this as often as they like; the partitioning, stacking and
+ * bar redraw it stands for are carried out once by commit() at the end of
+ * the current main loop iteration.
  */
 void
-arrange()
+arrange(void)
 {
-	Client *c, *next;
-	Client *tiled = NULL, *tlast = NULL;
-	Client *floating = NULL, *flast = NULL;
-	XEvent ev;
-
-	drawbar();
-	if (!mon.clients)
-		return;
-	
-	/* Partition clients into tiled and floating lists */
-	for (c = mon.clients; c; c = next) {
-		next = c->next;
-		c->next = NULL;
-		if (c->isfloating) {
-			if (!floating) {
-				floating = c;
-				flast = c;
-			} else {
-				flast->next = c;
-				flast = c;
-			}
-		} else {
-			if (!tiled) {
-				tiled = c;
-				tlast = c;
-			} else {
-				tlast->next = c;
-				tlast = c;
-			}
-		}
-	}
-	/* Merge lists: floating clients first, then tiled clients */
-	if (floating) {
-		mon.clients = floating;
-		flast->next = tiled;
-	} else {
-		mon.clients = tiled;
-	}
-
-	restack();
-
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	dirty |= DirtyLayout|DirtyStack|DirtyBar|DirtySnapshot;
 }
  
 void 
@@ -266,6 +405,8 @@ managedock(Window w, XWindowAttributes *wa) {
 	XMoveResizeWindow(dpy, w, mon.wx, mon.my + mon.mh - wa->height, mon.ww, wa->height);
 	/* Shrink the monitor's available window height to account for the dock */
 	mon.wh -= wa->height;
+	mon.geomgen++;
+	notify(SubDock, "1 0x%lx", w);
 }
 
 void
@@ -305,6 +446,161 @@ attach(Client *c)
     }
 }
 
+/*
+ * barsegment() - Records what a bar segment is about to show.
+ * Returns 0 when the bar pixmap already holds exactly that, so drawbar()
+ * can skip rendering and copying it.
+ */
+int
+barsegment(BarSeg *seg, const char *text, Clr *scm, int x, int w, int flags)
+{
+	if (seg->valid && seg->scm == scm && seg->x == x && seg->w == w
+	&& seg->flags == flags && !strcmp(seg->text, text))
+		return 0;
+	snprintf(seg->text, sizeof seg->text, "%s", text);
+	seg->scm = scm;
+	seg->x = x;
+	seg->w = w;
+	seg->flags = flags;
+	seg->valid = 1;
+	return 1;
+}
+
+/*
+ * batch() - Applies several operations as one transaction.
+ * body is a ';' separated list of "select ID", "floating [0|1]", "bar [0|1]"
+ * and "kill"; floating and kill act on the focused client, which an earlier
+ * select changes (kill only asks the client to close, it stays focused). All
+ * operations are validated against the state they will see before any is
+ * applied, so a bad one applies none. The handlers only schedule work, so the
+ * batch costs one commit(). The reply has one line per operation: "ok",
+ * "error: <why>" or "skipped".
+ */
+char*
+batch(char *body)
+{
+	struct { char *verb, *arg; Client *c; int val; const char *err; } op[BATCHMAX];
+	char *save, *tok, *rest, *end;
+	Client *sel = mon.clients;
+	int i, n = 0, bad = -1, showbar = mon.showbar;
+
+	reply.len = 0;
+	for (tok = body ? strtok_r(body, ";", &save) : NULL; tok; tok = strtok_r(NULL, ";", &save)) {
+		while (*tok == ' ')
+			tok++;
+		if (!*tok)
+			continue;
+		if (n == BATCHMAX) {
+			bufprintf(&reply, "error: more than %d operations\n", BATCHMAX);
+			return reply.data;
+		}
+		op[n].verb = strtok_r(tok, " ", &rest);
+		op[n].arg = strtok_r(NULL, " ", &rest);
+		op[n].err = NULL;
+		op[n].c = sel;
+		if (!strcmp(op[n].verb, "select")) {
+			if (!op[n].arg || !(op[n].c = wintoclient(strtoul(op[n].arg, &end, 0))) || *end)
+				op[n].err = "no such client";
+			else
+				sel = op[n].c;
+		} else if (!strcmp(op[n].verb, "floating")) {
+			if (!sel || sel->isfixed)
+				op[n].err = "no client that can float";
+			else if (op[n].arg && strcmp(op[n].arg, "0") && strcmp(op[n].arg, "1"))
+				op[n].err = "floating takes 0 or 1";
+			op[n].val = op[n].arg ? *op[n].arg == '1' : -1;
+		} else if (!strcmp(op[n].verb, "bar")) {
+			if (op[n].arg && strcmp(op[n].arg, "0") && strcmp(op[n].arg, "1"))
+				op[n].err = "bar takes 0 or 1";
+			op[n].val = op[n].arg ? *op[n].arg == '1' : !showbar;
+			showbar = op[n].val;
+		} else if (!strcmp(op[n].verb, "kill")) {
+			if (!sel)
+				op[n].err = "no client";
+		} else {
+			op[n].err = "unknown operation";
+		}
+		if (op[n].err && bad < 0)
+			bad = n;
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (bad >= 0) {
+			if (op[i].err)
+				bufprintf(&reply, "error: %s\n", op[i].err);
+			else
+				bufprintf(&reply, "skipped\n");
+			continue;
+		}
+		if (!strcmp(op[i].verb, "select")) {
+			focus(op[i].c);
+			arrange();
+		} else if (!strcmp(op[i].verb, "floating")) {
+			setfloating(op[i].c, op[i].val < 0 ? !op[i].c->isfloating : !!op[i].val);
+		} else if (!strcmp(op[i].verb, "bar")) {
+			if (mon.showbar != op[i].val)
+				togglebar(NULL);
+		} else if (!strcmp(op[i].verb, "kill")) {
+			killclientwin(op[i].c);
+		}
+		bufprintf(&reply, "ok\n");
+	}
+	bufprintf(&reply, "%s", "");
+	return reply.data;
+}
+
+/*
+ * bufjson() - Appends s to b as a JSON string, quotes included.
+ */
+void
+bufjson(Buf *b, const char *s)
+{
+	const char *p;
+
+	bufprintf(b, "\"");
+	for (; *s; s = p) {
+		/* copy runs that need no escaping in one go */
+		for (p = s; *p && *p != '"' && *p != '\\' && (unsigned char)*p >= ' '; p++);
+		if (p > s)
+			bufprintf(b, "%.*s", (int)(p - s), s);
+		if (!*p)
+			break;
+		if (*p == '"' || *p == '\\')
+			bufprintf(b, "\\%c", *p);
+		else
+			bufprintf(b, "\\u%04x", (unsigned char)*p);
+		p++;
+	}
+	bufprintf(b, "\"");
+}
+
+/*
+ * bufprintf() - Appends formatted text to b, growing it as needed.
+ * The storage is kept when b is reused (len = 0), so a handler that
+ * formats the same amount of state again does not allocate.
+ */
+void
+bufprintf(Buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			die("vsnprintf:");
+		if (b->len + n < b->cap)
+			break;
+		b->cap = MAX(b->cap * 2, b->len + n + 1);
+		if (!(b->data = realloc(b->data, b->cap)))
+			die("cannot realloc %zu bytes:", b->cap);
+	}
+	b->len += n;
+}
+
 /*
  * buttonpress() - Centralizes the dispatching of mouse button events.
  */
@@ -353,10 +649,18 @@ checkotherwm(void)
 void
 cleanup(void)
 {
+	Client *c;
 	size_t i;
 
+	for (i = 0; i < MAXCONNS; i++)
+		if (conns[i].fd >= 0)
+			connclose(&conns[i]);
 	close(sockfd);
+	close(timerfd);
 	unlink(SOCKET_PATH);
+	shm_unlink(SNAP_NAME);
+	for (c = mon.clients; c; c = c->next)
+		sethidden(c, 0); /* do not leave windows unmapped behind */
 	while (mon.clients)
 		unmanage(mon.clients, 0);
 	focus(NULL);
@@ -391,6 +695,114 @@ clientmessage(XEvent *e)
 		seturgent(c, 1);
 }
 
+/*
+ * coalesce() - Drops the events in evs[0..n) that evs[n] makes redundant.
+ * A later PropertyNotify for the same window and atom, a later ConfigureRequest
+ * for the same window (the earlier fields are merged into it), a later
+ * actionable EnterNotify and a later Expose of the same window (grown to
+ * cover both areas) each supersede their predecessor. The scan stops at user input and at events
+ * that change whether the window is managed, so dispatch order still holds.
+ * Dropped events are marked by clearing their type.
+ */
+void
+coalesce(XEvent *evs, int n)
+{
+	XEvent *ev = &evs[n], *p;
+	XConfigureRequestEvent *cr, *pcr;
+	Window w = evwindow(ev);
+	int i, x, y;
+
+	for (i = n - 1; i >= 0; i--) {
+		p = &evs[i];
+		if (p->type == KeyPress || p->type == ButtonPress
+		|| (p->type == MapRequest && p->xmaprequest.window == w)
+		|| (p->type == UnmapNotify && p->xunmap.window == w)
+		|| (p->type == DestroyNotify && p->xdestroywindow.window == w))
+			return;
+		if (p->type != ev->type)
+			continue;
+		switch (ev->type) {
+		case PropertyNotify:
+			if (p->xproperty.window != w || p->xproperty.atom != ev->xproperty.atom)
+				continue;
+			break;
+		case ConfigureRequest:
+			cr = &ev->xconfigurerequest;
+			pcr = &p->xconfigurerequest;
+			if (pcr->window != w)
+				continue;
+			if (!(cr->value_mask & CWX))		cr->x = pcr->x;
+			if (!(cr->value_mask & CWY))		cr->y = pcr->y;
+			if (!(cr->value_mask & CWWidth))	cr->width = pcr->width;
+			if (!(cr->value_mask & CWHeight))	cr->height = pcr->height;
+			if (!(cr->value_mask & CWBorderWidth))	cr->border_width = pcr->border_width;
+			if (!(cr->value_mask & CWSibling))	cr->above = pcr->above;
+			if (!(cr->value_mask & CWStackMode))	cr->detail = pcr->detail;
+			cr->value_mask |= pcr->value_mask;
+			break;
+		case EnterNotify:
+			/* only crossings enternotify() acts on replace each other */
+			if ((ev->xcrossing.mode != NotifyNormal || ev->xcrossing.detail == NotifyInferior)
+			|| (p->xcrossing.mode != NotifyNormal || p->xcrossing.detail == NotifyInferior))
+				return;
+			break;
+		case Expose:
+			if (p->xexpose.window != w)
+				continue;
+			/* grow the later rectangle so no exposed area is lost */
+			x = MIN(p->xexpose.x, ev->xexpose.x);
+			y = MIN(p->xexpose.y, ev->xexpose.y);
+			ev->xexpose.width = MAX(p->xexpose.x + p->xexpose.width,
+				ev->xexpose.x + ev->xexpose.width) - x;
+			ev->xexpose.height = MAX(p->xexpose.y + p->xexpose.height,
+				ev->xexpose.y + ev->xexpose.height) - y;
+			ev->xexpose.x = x;
+			ev->xexpose.y = y;
+			break;
+		default:
+			return;
+		}
+		p->type = 0;
+		evcoalesced++;
+		return;
+	}
+}
+
+/*
+ * commit() - Applies the work scheduled through the dirty flags.
+ * run() calls this once per iteration, after all pending X and socket events
+ * have been handled, so a batch of events costs at most one layout, one
+ * restack, one bar redraw and one _NET_CLIENT_LIST update.
+ */
+void
+commit(void)
+{
+	XEvent ev;
+	long long wait;
+	unsigned int d = dirty;
+
+	dirty = 0;
+	if (d & DirtyLayout)
+		layout();
+	if (d & DirtyStack)
+		restack();
+	if (d & DirtyBar) {
+		/* throttle bursts of title and status updates to barinterval */
+		if ((wait = lastbar + barinterval - monotonicms()) > 0) {
+			dirty |= DirtyBar;
+			schedule(TimerBar, wait);
+		} else {
+			drawbar();
+		}
+	}
+	if (d & DirtyClientList)
+		updateclientlist();
+	if (d & DirtySnapshot)
+		updatesnapshot();
+	if (d & (DirtyLayout|DirtyStack))
+		while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+}
+
 /*
  * configure() - Syncs client's state by sending a ConfigureNotify event.
  * Centralizes state updates for consistent window management.
@@ -432,6 +844,7 @@ configurenotify(XEvent *e)
 		sh = ev->height;
 		if (updategeom() || dirty) {
 			drw_resize(drw, sw, bh);
+			memset(barseg, 0, sizeof(barseg)); /* the pixmap is new */
 			createbar();
 			XMoveResizeWindow(dpy, mon.barwin, mon.wx, mon.by, mon.ww, bh);
 			focus(NULL);
@@ -475,7 +888,6 @@ configurerequest(XEvent *e)
 		wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
 	}
-	XSync(dpy, False);
 }
 
 void
@@ -530,83 +942,405 @@ detach(Client *c)
  * This function is critical because it integrates external IPC requests into the
  * WM's core event loop, allowing remote commands to dynamically influence the state
  * and configuration of the window manager. 
+ * It only accepts connections; they are non-blocking and live in conns[], where
+ * run() polls them and connevent() serves their requests.
  */
 static void dispatchsocketevent(void) {
-	int fd = accept(sockfd, NULL, NULL);
-	char buffer[1024] = {0};
-	ssize_t r_size, w_size;
+	Conn *c;
+	int fd, i;
 
-	if (fd < 0)
-		return;
+	while (nconns < MAXCONNS) {
+		if ((fd = accept(sockfd, NULL, NULL)) < 0)
+			return;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		for (i = 0; conns[i].fd >= 0; i++);
+		c = &conns[i];
+		memset(c, 0, sizeof(*c));
+		c->fd = fd;
+		nconns++;
+	}
+}
 
-	/* read in request */
-	r_size = read(fd, buffer, sizeof(buffer) - 1);
-	if (r_size <= 0) {
-		close(fd);
+/*
+ * connbinary() - Serves the first complete IpcHeader framed request on c.
+ * Replies echo the op and id so that clients can pipeline requests.
+ * GetClients is answered with IpcClient records gathered straight from
+ * the clients, other commands with the text their handler returns.
+ * Returns 0 if no request is complete.
+ */
+int
+connbinary(Conn *c)
+{
+	IpcHeader h, r = { IPC_MAGIC, IPC_VERSION, 0, 0, 0, IpcOk };
+	struct iovec iov[2];
+	char *payload, *ret = NULL;
+	long long start;
+
+	if (c->rlen < sizeof h)
+		return 0;
+	memcpy(&h, c->rbuf, sizeof h);
+	if (h.magic != IPC_MAGIC || h.len > MAXREQUEST - sizeof h) {
+		c->done = 1; /* lost the framing, nothing after this can be parsed */
+		return 0;
+	}
+	if (c->rlen < sizeof h + h.len)
+		return 0;
+	if (!(payload = strndup(c->rbuf + sizeof h, h.len)))
+		die("strndup:");
+	memmove(c->rbuf, c->rbuf + sizeof h + h.len, c->rlen - sizeof h - h.len);
+	c->rlen -= sizeof h + h.len;
+
+	r.op = h.op;
+	r.id = h.id;
+	if (h.version != IPC_VERSION)
+		r.status = IpcBadVersion;
+	else if (h.op >= LENGTH(shandler))
+		r.status = IpcBadOp;
+	else {
+		ipcconn = c;
+		start = monotonicus();
+		watchbegin("socket", sname[h.op], None, start);
+		if (h.op == GetClients)
+			sendclients(c, &r);
+		else if (!(ret = shandler[h.op](payload)) && h.op == SelectClient)
+			r.status = IpcNotFound;
+		watchend();
+		histrecord(&shist[h.op], monotonicus() - start);
+		ipcconn = NULL;
+	}
+	if (h.op != GetClients || r.status != IpcOk) {
+		r.len = ret ? strlen(ret) : 0;
+		iov[0].iov_base = &r;
+		iov[0].iov_len = sizeof r;
+		iov[1].iov_base = ret;
+		iov[1].iov_len = r.len;
+		connsend(c, iov, ret ? 2 : 1);
+	}
+	free(payload);
+	return 1;
+}
+
+/*
+ * connclose() - Closes an IPC connection and frees its slot.
+ */
+void
+connclose(Conn *c)
+{
+	if (c->subscribed)
+		nsubscribers--;
+	close(c->fd);
+	free(c->rbuf);
+	free(c->wbuf);
+	memset(c, 0, sizeof(*c));
+	c->fd = -1;
+	nconns--;
+}
+
+/*
+ * connevent() - Serves an IPC connection that poll() reported ready.
+ * Reads whatever is available, answers up to CONNBATCH complete requests and
+ * writes as much of the replies as the socket takes; the rest waits for
+ * POLLOUT. A connection never blocks the event loop.
+ */
+void
+connevent(Conn *c, short revents)
+{
+	ssize_t n;
+	int i, left = 0;
+
+	/* subscribers only receive; a hangup means nobody is listening */
+	if (c->subscribed && revents & (POLLHUP|POLLERR)) {
+		connclose(c);
+		return;
+	}
+	while (revents & (POLLIN|POLLHUP|POLLERR) && !c->done) {
+		if (c->rlen == c->rcap) {
+			if (c->rcap >= MAXREQUEST)
+				break; /* serve what is buffered first */
+			c->rcap = c->rcap ? c->rcap * 2 : 1024;
+			if (!(c->rbuf = realloc(c->rbuf, c->rcap)))
+				die("cannot realloc %zu bytes:", c->rcap);
+		}
+		if ((n = read(c->fd, c->rbuf + c->rlen, c->rcap - c->rlen)) > 0) {
+			c->rlen += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0 || errno != EAGAIN)
+			c->eof = 1;
+		break;
+	}
+	/* stop at CONNBATCH, and while a peer does not read its replies */
+	for (i = 0; !c->done && !c->subscribed; i++) {
+		if (i == CONNBATCH || c->wlen >= MAXPENDING) {
+			left = 1;
+			break;
+		}
+		if (!connrequest(c))
+			break;
+	}
+	if (!i && !left && c->rlen >= MAXREQUEST) {
+		connclose(c); /* no request is that long */
 		return;
 	}
-	buffer[r_size] = '\0';  
+	/* whatever is left after EOF can never complete */
+	if (c->eof && !left && !c->subscribed)
+		c->done = 1;
+	connwrite(c);
+	/* replies written out make room for the requests left */
+	if (c->fd >= 0)
+		c->more = left && c->wlen < MAXPENDING;
+}
+
+/*
+ * connqueue() - Appends data to c's pending output.
+ */
+void
+connqueue(Conn *c, const void *data, size_t len)
+{
+	if (c->wlen + len > c->wcap) {
+		c->wcap = MAX(c->wcap * 2, c->wlen + len);
+		if (!(c->wbuf = realloc(c->wbuf, c->wcap)))
+			die("cannot realloc %zu bytes:", c->wcap);
+	}
+	memcpy(c->wbuf + c->wlen, data, len);
+	c->wlen += len;
+}
+
+/*
+ * connrequest() - Serves the first complete request buffered on c.
+ * Requests are "op\npayload". The first bytes decide the framing, which is
+ * never mixed: a connection starting with IPC_MAGIC speaks the binary
+ * protocol, see connbinary(). Otherwise the request is text and ends after
+ * its payload line, or after the op line for ops without a payload and for
+ * ops whose optional payload has not begun (Stats, Subscribe), or at EOF;
+ * the connection is closed after the reply, which keeps
+ * "printf ... | nc -U" working. A KeepAlive request makes the connection
+ * persistent: from then on each request and each reply ends with a NUL byte.
+ * Returns 0 if no request is complete.
+ */
+int
+connrequest(Conn *c)
+{
+	char *end, *req, *op, *payload, *ret;
+	size_t len;
+	long long start;
+	int sevent;
+
+	if (!c->persistent && c->rlen && (unsigned char)c->rbuf[0] == IPC_MAGIC)
+		c->binary = c->persistent = 1;
+	if (c->binary)
+		return connbinary(c);
+	if (c->persistent) {
+		if (!(end = memchr(c->rbuf, '\0', c->rlen)))
+			return 0;
+		len = end - c->rbuf + 1;
+	} else if ((end = memchr(c->rbuf, '\n', c->rlen))) {
+		len = end - c->rbuf + 1;
+		sevent = atoi(c->rbuf);
+		/* an optional payload line is only awaited once it has begun */
+		if (sevent >= 0 && sevent < LENGTH(spayload) && (spayload[sevent] == PayloadRequired
+		|| (spayload[sevent] == PayloadOptional && len < c->rlen))) {
+			if ((end = memchr(c->rbuf + len, '\n', c->rlen - len)))
+				len = end - c->rbuf + 1;
+			else if (c->eof)
+				len = c->rlen;
+			else
+				return 0;
+		}
+	} else if (c->rlen && c->eof) {
+		len = c->rlen;
+	} else {
+		return 0;
+	}
+	if (!(req = strndup(c->rbuf, len)))
+		die("strndup:");
+	memmove(c->rbuf, c->rbuf + len, c->rlen - len);
+	c->rlen -= len;
 
 	/* socket protocol is- request \n payload */
-	char *sevent_str = strtok(buffer, DELIMITER);
-	char *payload = strtok(NULL, DELIMITER);
-
-	if (sevent_str != NULL) {
-		int sevent = atoi(sevent_str);
-		/* check if the event is within the bounds of the handler array */
-		if (sevent >= 0 && sevent < sizeof(shandler) / sizeof(shandler[0])) {
-			/* call handler and write response if one exists */
-			char *ret = shandler[sevent](payload);
-			if (ret) {
-				size_t total_written = 0, len = strlen(ret);
-				while (total_written < len) {
-					w_size = write(fd, ret + total_written, len - total_written);
-					if (w_size < 0) {
-						if (errno == EINTR || errno == EAGAIN)
-							continue;
-						perror("write error");
-						break;
-					}
-					total_written += w_size;
-				}
+	ret = NULL;
+	op = strtok(req, DELIMITER);
+	payload = strtok(NULL, DELIMITER);
+	if (op && (sevent = atoi(op)) >= 0 && sevent < LENGTH(shandler)) {
+		ipcconn = c;
+		start = monotonicus();
+		watchbegin("socket", sname[sevent], None, start);
+		ret = shandler[sevent](payload);
+		watchend();
+		histrecord(&shist[sevent], monotonicus() - start);
+		ipcconn = NULL;
+	}
+	if (ret || (c->persistent && !c->subscribed))
+		/* the NUL terminator of ret frames persistent replies */
+		connqueue(c, ret ? ret : "", (ret ? strlen(ret) : 0) + !!c->persistent);
+	if (!c->persistent && !c->subscribed)
+		c->done = 1;
+	free(req);
+	return 1;
+}
+
+/*
+ * connsend() - Sends the gathered buffers without copying them first.
+ * Whatever the socket does not take now, or everything if replies are
+ * already waiting, is queued for connwrite().
+ */
+void
+connsend(Conn *c, struct iovec *iov, int n)
+{
+	struct msghdr msg = { 0 };
+	ssize_t sent = 0;
+	int i;
+
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+	if (!c->wlen)
+		while ((sent = sendmsg(c->fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+	if (sent < 0)
+		sent = 0; /* connwrite() finds out whether the peer is gone */
+	for (i = 0; i < n; i++) {
+		if ((size_t)sent >= iov[i].iov_len) {
+			sent -= iov[i].iov_len;
+			continue;
+		}
+		connqueue(c, (char *)iov[i].iov_base + sent, iov[i].iov_len - sent);
+		sent = 0;
+	}
+}
+
+/*
+ * connwrite() - Writes as much of c's pending replies as the socket takes.
+ * What it does not take moves to the front of wbuf, so wlen counts unsent
+ * bytes between calls. Closes the connection once it is done and
+ * everything has been written.
+ */
+void
+connwrite(Conn *c)
+{
+	ssize_t n;
+
+	while (c->woff < c->wlen) {
+		n = send(c->fd, c->wbuf + c->woff, c->wlen - c->woff, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN) {
+			/* move the unsent tail to the front, run() polls for POLLOUT */
+			memmove(c->wbuf, c->wbuf + c->woff, c->wlen - c->woff);
+			c->wlen -= c->woff;
+			c->woff = 0;
+			return;
+		}
+		if (n < 0) {
+			connclose(c); /* peer went away */
+			return;
+		}
+		c->woff += n;
+	}
+	c->woff = c->wlen = 0;
+	if (c->done)
+		connclose(c);
+}
+
+/*
+ * drainevents() - Reads all pending X events in batches of EVENTBATCH, lets
+ * coalesce() drop the redundant ones and dispatches the rest in order.
+ * A ButtonPress closes its batch because movemouse() and resizemouse() read
+ * the queue themselves and must see the events that follow it.
+ */
+void
+drainevents(void)
+{
+	static XEvent evs[EVENTBATCH];
+	long long start;
+	int i, n;
+
+	while (XPending(dpy)) {
+		for (n = 0; n < EVENTBATCH && (n == 0 || XEventsQueued(dpy, QueuedAlready)); n++) {
+			XNextEvent(dpy, &evs[n]);
+			evreceived++;
+			coalesce(evs, n);
+			if (evs[n].type == ButtonPress) {
+				n++;
+				break;
+			}
+		}
+		for (i = 0; i < n; i++) {
+			if (evs[i].type && xhandler[evs[i].type]) {
+				evdispatched++;
+				start = monotonicus();
+				watchbegin(xname[evs[i].type].event, xname[evs[i].type].handler,
+					evwindow(&evs[i]), start);
+				xhandler[evs[i].type](&evs[i]);
+				watchend();
+				histrecord(&xhist[evs[i].type], monotonicus() - start);
 			}
 		}
 	}
-	memset(buffer, 0, sizeof(buffer)); 
-	close(fd);
+}
+
+/* evwindow() - Returns the window an event is about, rather than the one it was reported to. */
+Window
+evwindow(XEvent *e)
+{
+	switch (e->type) {
+	case ConfigureRequest:	return e->xconfigurerequest.window;
+	case MapRequest:	return e->xmaprequest.window;
+	case UnmapNotify:	return e->xunmap.window;
+	case DestroyNotify:	return e->xdestroywindow.window;
+	default:		return e->xany.window;
+	}
 }
 
 /*
  * drawbar() - Renders the status bar providing user feedback and desktop information.
- * This function is critical because it centralizes the rendering of dynamic UI elements,
- * including the active client title and status text. Its design minimizes redraw latency,
- * ensuring a seamless visual experience as WM state changes.
+ * The bar consists of the status text on the right and the focused client's
+ * title on the left. Each segment is cached in barseg[] and re-rendered only
+ * when its text, scheme, geometry or flags changed; only the span of the
+ * repainted segments is copied to the bar window.
  */
 void
 drawbar()
 {
-	int x, w, tw = 0;
+	int x, w, tw = 0, flags;
+	int x0 = mon.ww, x1 = 0; /* damaged span */
 	int boxs = drw->fonts->h / 9;
 	int boxw = drw->fonts->h / 6 + 2;
+	Client *c = mon.clients;
 
 	if (!mon.showbar)
 		return;
 
+	lastbar = monotonicms();
 	drw_setscheme(drw, scheme[SchemeNorm]);
-	tw = TEXTW(stext) - lrpad + 2; /* 2px right padding */
-	drw_text(drw, mon.ww - tw, 0, tw, bh, 0, stext, 0);
+	if (barseg[SegStatus].valid && !strcmp(barseg[SegStatus].text, stext))
+		tw = barseg[SegStatus].w;
+	else
+		tw = TEXTW(stext) - lrpad + 2; /* 2px right padding */
+	if (barsegment(&barseg[SegStatus], stext, scheme[SchemeNorm], mon.ww - tw, tw, 0)) {
+		drw_text(drw, mon.ww - tw, 0, tw, bh, 0, stext, 0);
+		x0 = mon.ww - tw;
+		x1 = mon.ww;
+	}
 
 	x = 0;
 	if ((w = mon.ww - tw - x) > bh) {
-		if (mon.clients) {
-			drw_text(drw, x, 0, w, bh, lrpad / 2, mon.clients->name, 0);
-			if (mon.clients->isfloating)
-				drw_rect(drw, x + boxs, boxs, boxw, boxw, mon.clients->isfixed, 0);
-		} else {
-			drw_rect(drw, x, 0, w, bh, 1, 1);
+		flags = c ? 1 | c->isfloating << 1 | c->isfixed << 2 : 0;
+		if (barsegment(&barseg[SegTitle], c ? c->name : "", scheme[SchemeNorm], x, w, flags)) {
+			if (c) {
+				drw_text(drw, x, 0, w, bh, lrpad / 2, c->name, 0);
+				if (c->isfloating)
+					drw_rect(drw, x + boxs, boxs, boxw, boxw, c->isfixed, 0);
+			} else {
+				drw_rect(drw, x, 0, w, bh, 1, 1);
+			}
+			x0 = MIN(x0, x);
+			x1 = MAX(x1, x + w);
 		}
 	}
-	drw_map(drw, mon.barwin, 0, 0, mon.ww, bh);
+	if (x0 < x1)
+		drw_map(drw, mon.barwin, x0, 0, x1 - x0, bh);
 }
 
 /*
@@ -622,7 +1356,7 @@ enternotify(XEvent *e)
 	if ((ev->mode != NotifyNormal || ev->detail == NotifyInferior) && ev->window != root)
 		return;
 	c = wintoclient(ev->window);
-	if (!c)
+	if (!c || c == mon.clients)
 		return;
 	fprintf(stderr, "Focus-follows-mouse: losing %s, gaining %s\n", 
 			mon.clients ? mon.clients->name : "none", c->name);
@@ -638,9 +1372,10 @@ void
 expose(XEvent *e)
 {
 	XExposeEvent *ev = &e->xexpose;
-	
-	if (ev->count == 0 )
-		drawbar();
+
+	/* the bar pixmap still holds the last drawbar(), copy the exposed part */
+	if (ev->window == mon.barwin)
+		drw_map(drw, mon.barwin, ev->x, ev->y, ev->width, ev->height);
 }
 
 /*
@@ -671,7 +1406,11 @@ focus(Client *c)
 		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
 		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	}
-	drawbar();
+	if ((c ? c->win : None) != focuswin) {
+		focuswin = c ? c->win : None;
+		notify(SubFocus, "0x%lx", focuswin);
+	}
+	dirty |= DirtyBar|DirtySnapshot;
 }
 
 /* there are some broken focus acquiring clients needing extra handling */
@@ -702,18 +1441,11 @@ getatomprop(Client *c, Atom prop)
 
 char* 
 getclients(char *unused) {
-	static char buf[4096];
-	int i = 0;
-	buf[0] = '\0'; 
-
-	for (Client *c = mon.clients; c != NULL; c = c->next, ++i) {
-		/* Ensure buffer doesn't overflow, account for number length, 
-		name length, 2 extra chars for space and newline */
-		if (strlen(buf) + strlen(c->name) + 10 > sizeof(buf)) 
-			break; 
-		snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "%d %s\n", i, c->name);
-	}
-	return buf;
+	reply.len = 0;
+	bufprintf(&reply, "%s", ""); /* no clients is still a reply */
+	for (Client *c = mon.clients; c != NULL; c = c->next)
+		bufprintf(&reply, "0x%lx %s\n", c->win, c->name);
+	return reply.data;
 }
 
 int
@@ -846,6 +1578,75 @@ grabkeys(void)
 	}
 }
 
+/*
+ * hashclient() - Adds a client to the window to client index.
+ * Every X event handler resolves its window through wintoclient(), so the
+ * index keeps that lookup independent of the number of managed clients.
+ */
+void
+hashclient(Client *c)
+{
+	unsigned int h = CLIENTHASH(c->win);
+
+	c->hnext = clienttable[h];
+	clienttable[h] = c;
+}
+
+/*
+ * histpercentile() - Returns the sample value below which a fraction p of the
+ * recorded samples fall, as the upper edge of its bucket capped at the maximum.
+ */
+unsigned long
+histpercentile(const Histogram *h, double p)
+{
+	unsigned long seen = 0, rank = p * h->count + 0.5, edge;
+	int b;
+
+	if (!h->count)
+		return 0;
+	for (b = 0; b < HISTBUCKETS - 1; b++)
+		if ((seen += h->buckets[b]) >= rank && seen)
+			break;
+	if (b < HISTSUB)
+		edge = b;
+	else
+		edge = ((unsigned long)(HISTSUB + b % HISTSUB + 1) << (b / HISTSUB - 1)) - 1;
+	return MIN(edge, h->max);
+}
+
+/*
+ * histrecord() - Adds a latency sample to a histogram.
+ * Values below HISTSUB microseconds get a bucket each; above that every power
+ * of two is split into HISTSUB linear buckets, bounding the error to 1/HISTSUB.
+ * Recording is a handful of integer operations, so it always stays enabled.
+ */
+void
+histrecord(Histogram *h, long long us)
+{
+	unsigned long v = us > 0 ? us : 0;
+	int b, e;
+
+	if (v < HISTSUB) {
+		b = v;
+	} else {
+		e = 8 * sizeof(unsigned long) - 1 - __builtin_clzl(v); /* floor(log2(v)) */
+		b = (e - 2) * HISTSUB + ((v >> (e - 3)) & (HISTSUB - 1));
+	}
+	h->buckets[MIN(b, HISTBUCKETS - 1)]++;
+	h->count++;
+	h->max = MAX(h->max, v);
+}
+
+/* histwrite() - Formats one histogram summary as a JSON member for stats(). */
+void
+histwrite(Buf *b, const char *name, const Histogram *h, int first)
+{
+	bufprintf(b,
+		"%s\n    \"%s\": { \"count\": %lu, \"p50_us\": %lu, \"p99_us\": %lu, \"max_us\": %lu }",
+		first ? "" : ",", name, h->count, histpercentile(h, 0.50),
+		histpercentile(h, 0.99), h->max);
+}
+
 /*
  * keypress() - Dispatches key events to their bound actions.
  * Maps user key inputs to functions.
@@ -866,17 +1667,36 @@ keypress(XEvent *e)
 			keys[i].func(&(keys[i].arg));
 }
 
+/*
+ * keepalive() - Keeps the requesting connection open for more requests.
+ * From here on requests and replies on it are terminated by a NUL byte.
+ */
+char*
+keepalive(char *unused)
+{
+	ipcconn->persistent = 1;
+	return NULL;
+}
+
 void
 killclient(const Arg *arg)
 {
-	if (!mon.clients)
-		return;
-	if (!sendevent(mon.clients, wmatom[WMDelete])) {
-		detach(mon.clients);
+	if (mon.clients)
+		killclientwin(mon.clients);
+}
+
+/*
+ * killclientwin() - Asks c to close via WM_DELETE_WINDOW, or kills its X
+ * connection if it does not support the protocol.
+ */
+void
+killclientwin(Client *c)
+{
+	if (!sendevent(c, wmatom[WMDelete])) {
 		XGrabServer(dpy);
 		XSetErrorHandler(xerrordummy);
 		XSetCloseDownMode(dpy, DestroyAll);
-		XKillClient(dpy, mon.clients->win);
+		XKillClient(dpy, c->win);
 		XSync(dpy, False);
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
@@ -892,6 +1712,69 @@ logXErrors(Display *dpy, XErrorEvent *e) {
     return 0; 
 }
 
+/*
+ * layout() - Partitions the client list so floating clients come first and
+ * fits the tiled clients to the window area. Stacking follows list order,
+ * which keeps floating windows above the tiled ones. Only commit() calls
+ * this, see arrange().
+ */
+void
+layout(void)
+{
+	Client *c, *next;
+	Client *tiled = NULL, *tlast = NULL;
+	Client *floating = NULL, *flast = NULL;
+
+	if (!mon.clients)
+		return;
+	
+	/* Partition clients into tiled and floating lists */
+	for (c = mon.clients; c; c = next) {
+		next = c->next;
+		c->next = NULL;
+		if (c->isfloating) {
+			if (!floating) {
+				floating = c;
+				flast = c;
+			} else {
+				flast->next = c;
+				flast = c;
+			}
+		} else {
+			if (!tiled) {
+				tiled = c;
+				tlast = c;
+			} else {
+				tlast->next = c;
+				tlast = c;
+			}
+		}
+	}
+	/* Merge lists: floating clients first, then tiled clients */
+	if (floating) {
+		mon.clients = floating;
+		flast->next = tiled;
+	} else {
+		mon.clients = tiled;
+	}
+	/*
+	 * resize() only talks to the server when the geometry differs. Covered
+	 * clients skip a changed window area until they are on top again, so a
+	 * bar or dock change costs the visible client a relayout, not all of them.
+	 */
+	for (c = tiled; c; c = c->next) {
+		if (c == tiled || c->geomgen == mon.geomgen) {
+			resize(c, mon.wx, mon.wy, mon.ww, mon.wh);
+			c->geomgen = mon.geomgen;
+		}
+		/* the top tiled client comes first, so it is mapped before the rest go */
+		sethidden(c, hidebackground && c != tiled);
+	}
+	/* a hidden client that became floating is shown again */
+	for (c = floating; c && c != tiled; c = c->next)
+		sethidden(c, 0);
+}
+
 /*
  * manage() - Integrates a new client window into the window manager.
  * This function is critical because it centralizes client initialization,
@@ -911,6 +1794,7 @@ manage(Window w, XWindowAttributes *wa)
 	c->w = c->oldw = wa->width;
 	c->h = c->oldh = wa->height;
 	c->bw = c->oldbw = borderpx;
+	c->stackpos = -1;
 
 	/* update client state and properties */
 	updatetitle(c);
@@ -924,13 +1808,13 @@ manage(Window w, XWindowAttributes *wa)
 	c->isfloating = c->isfixed;
 
 	/* EWMH and X11 integration */
-	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
-		(unsigned char *) &(c->win), 1);
-
+	dirty |= DirtyClientList;
 	setclientstate(c, NormalState);
 
 	/* attach, arrange, resize, notify, render, and focus */
+	hashclient(c);
 	attach(c);
+	notify(SubAdd, "0x%lx %s", c->win, c->name);
 	arrange();
 	resize(c, c->x, c->y, c->w, c->h);
 	configure(c); 
@@ -938,6 +1822,24 @@ manage(Window w, XWindowAttributes *wa)
 	focus(NULL);
 }
 
+long long
+monotonicms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+long long
+monotonicus(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 /*
  * mappingnotify() - Refreshes keyboard mapping and re-establishes key bindings.
  * This function is critical in maintaining reliable keyboard input after a 
@@ -989,6 +1891,7 @@ movemouse(const Arg *arg)
 	if (!c->isfloating)
 		return;
 	arrange();
+	commit();
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
 		None, cursor[CurMove]->cursor, CurrentTime) != GrabSuccess)
 		return;
@@ -997,6 +1900,9 @@ movemouse(const Arg *arg)
 	int ix = x, iy = y;
 	int ox = c->x, oy = c->y;
 	unsigned long lastMotionTime = 0;
+	/* the drag lasts as long as the user wants, it is no stall */
+	watchend();
+	watchset(0);
 	do {
 		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
 		switch(ev.type) {
@@ -1004,6 +1910,7 @@ movemouse(const Arg *arg)
 		case Expose:
 		case MapRequest:
 			xhandler[ev.type](&ev);
+			commit();
 			break;
 		case MotionNotify:
 		{
@@ -1027,6 +1934,51 @@ movemouse(const Arg *arg)
 		}
 	} while (ev.type != ButtonRelease);
 	XUngrabPointer(dpy, CurrentTime);
+	if (stallbudget)
+		watchset(stallbudget * 1000LL);
+}
+
+/*
+ * notify() - Pushes one event line to the subscribers that asked for ev.
+ * Binary subscribers get it framed as a Subscribe reply with id 0.
+ * The line is queued and written before run() goes back to poll(). A
+ * subscriber that falls more than MAXBACKLOG bytes behind is dropped
+ * instead of slowing the wm down.
+ */
+void
+notify(int ev, const char *fmt, ...)
+{
+	IpcHeader h = { IPC_MAGIC, IPC_VERSION, Subscribe, 0, 0, IpcOk };
+	char line[512], *p;
+	va_list ap;
+	Conn *c;
+	int i, n;
+
+	if (!nsubscribers)
+		return;
+	n = snprintf(line, sizeof line, "%s ", subname[ev]);
+	va_start(ap, fmt);
+	vsnprintf(line + n, sizeof line - n - 1, fmt, ap);
+	va_end(ap);
+	for (p = line; *p; p++)
+		if ((unsigned char)*p < ' ')
+			*p = ' '; /* one event per line, whatever the title holds */
+	*p++ = '\n';
+	n = p - line;
+	for (i = 0; i < MAXCONNS; i++) {
+		c = &conns[i];
+		if (c->fd < 0 || !(c->subscribed & 1 << ev))
+			continue;
+		if (c->wlen - c->woff + n > MAXBACKLOG) {
+			connclose(c);
+			continue;
+		}
+		if (c->binary) {
+			h.len = n;
+			connqueue(c, &h, sizeof h);
+		}
+		connqueue(c, line, n);
+	}
 }
 
 /*
@@ -1060,13 +2012,13 @@ propertynotify(XEvent *e)
 			break;
 		case XA_WM_HINTS:
 			updatewmhints(c);
-			drawbar();
+			dirty |= DirtyBar;
 			break;
 		}
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
 			updatetitle(c);
 			if (c == mon.clients)
-				drawbar();
+				dirty |= DirtyBar;
 		}
 		if (ev->atom == netatom[NetWMWindowType])
 			updatewindowtype(c);
@@ -1122,7 +2074,7 @@ resize(Client *c, int x, int y, int w, int h)
 		wc.border_width = c->bw;
 		XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
 		configure(c);
-		XSync(dpy, False);
+		dirty |= DirtySnapshot;
 	}
 }
 
@@ -1148,10 +2100,14 @@ resizemouse(const Arg *arg)
 	int origw = c->w, origh = c->h;
 	
 	arrange();
+	commit();
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
 		None, cursor[CurResize]->cursor, CurrentTime) != GrabSuccess)
 		return;
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
+	/* the drag lasts as long as the user wants, it is no stall */
+	watchend();
+	watchset(0);
 	do {
 		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
 		switch(ev.type) {
@@ -1159,6 +2115,7 @@ resizemouse(const Arg *arg)
 		case Expose:
 		case MapRequest:
 			xhandler[ev.type](&ev);
+			commit();
 			break;
 		case MotionNotify:
 		{
@@ -1179,68 +2136,196 @@ resizemouse(const Arg *arg)
 	} while (ev.type != ButtonRelease);
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
 	XUngrabPointer(dpy, CurrentTime);
+	if (stallbudget)
+		watchset(stallbudget * 1000LL);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
+/*
+ * restack() - Stacks the clients below the bar in list order.
+ * Clients whose positions in the last committed order are still increasing
+ * (the longest such run) are already stacked correctly relative to each
+ * other and are left alone; every other client is put directly below its
+ * new predecessor, top to bottom. Moving one client to the front is thus a
+ * single request relative to the bar.
+ */
 void
 restack(void)
 {
+	static Client **st;
+	static int *tails, *prevs, cap;
+	static char *keep;
 	Client *c;
 	XWindowChanges wc;
+	int i, k, lo, hi, mid, n = 0, len = 0;
+
+	for (c = mon.clients; c; c = c->next) {
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			if (!(st = realloc(st, cap * sizeof *st))
+			|| !(tails = realloc(tails, cap * sizeof *tails))
+			|| !(prevs = realloc(prevs, cap * sizeof *prevs))
+			|| !(keep = realloc(keep, cap * sizeof *keep)))
+				die("cannot realloc %zu bytes:", cap * sizeof *st);
+		}
+		st[n++] = c;
+	}
+
+	/* longest increasing subsequence of the previous stacking positions */
+	for (i = 0; i < n; i++) {
+		keep[i] = 0;
+		prevs[i] = -1;
+		if (st[i]->stackpos < 0)
+			continue;
+		for (lo = 0, hi = len; lo < hi; ) {
+			mid = (lo + hi) / 2;
+			if (st[tails[mid]]->stackpos < st[i]->stackpos)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo > 0)
+			prevs[i] = tails[lo - 1];
+		tails[lo] = i;
+		if (lo == len)
+			len++;
+	}
+	for (k = len ? tails[len - 1] : -1; k >= 0; k = prevs[k])
+		keep[k] = 1;
 
 	wc.stack_mode = Below;
 	wc.sibling = mon.barwin;
-	/* Iterate over sorted client list, configuring windows in order */
-	for (c = mon.clients; c; c = c->next) {
-		if (!c->isfloating)
-			resize(c, mon.wx, mon.wy, mon.ww, mon.wh);
-		XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
-		wc.sibling = c->win;
+	for (i = 0; i < n; i++) {
+		if (!keep[i])
+			XConfigureWindow(dpy, st[i]->win, CWSibling|CWStackMode, &wc);
+		st[i]->stackpos = i;
+		wc.sibling = st[i]->win;
 	}
-	XSync(dpy, False);
 }
 
 /*
  * run() - Main event loop integrating X events and socket events.
- * This function polls both the X connection and a local socket so that
- * it can handle user interactions (like window events) as well as interprocess
- * commands. Single poll-based loop helps keep things fast.
+ * This function polls the X connection, a local socket, a timerfd and the
+ * pipe of drw's fallback font lookups so that it can handle user
+ * interactions (like window events) as well as interprocess commands.
+ * Single poll-based loop helps keep things fast.
+ * poll() blocks without a timeout; the timerfd is only armed while deferred
+ * work is scheduled (see schedule()), so an idle wm does not wake up at all.
+ * Handlers only queue requests; the output buffer is flushed once, without
+ * waiting for replies, before going back to poll(). XSync is reserved for
+ * the places that swap the error handler around a request (unmanage(),
+ * killclient(), checkotherwm()).
  */
 void run(void) {
-	XEvent ev;
-	int xfd, timeout;
-	struct pollfd fds[2];
-
-	xfd = ConnectionNumber(dpy);
-	timeout = 100; // Poll timeout in milliseconds
+	struct pollfd fds[4 + MAXCONNS];
+	Conn *polled[MAXCONNS];
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	long long next;
+	int i, nfds, more;
 
    	/* Initialize pollfd structure */
-	fds[0].fd = xfd;
+	fds[0].fd = ConnectionNumber(dpy);
 	fds[0].events = POLLIN; // Check for data to read from X server
 	fds[1].fd = sockfd;
 	fds[1].events = POLLIN; // Check for data to read from socket
+	fds[2].fd = timerfd;
+	fds[2].events = POLLIN; // Check for due deferred work
+	fds[3].fd = drw_fontset_fd(drw);
+	fds[3].events = POLLIN; // Check for fallback fonts found in the background
 
 	/* main event loop */
 	XSync(dpy, False);
+	wakeuprate(); /* start the first measurement window */
 	while (running) {
-		/* Poll the set of file descriptors */
-		int num_ready = poll(fds, 2, timeout);
-		if (num_ready > 0) {
+		/* Apply the work scheduled by the last batch of events */
+		watchbegin("commit", "commit", None, monotonicus());
+		commit();
+		watchend();
+		/* Arm the timerfd for the earliest deferred work, if it changed */
+		for (next = 0, i = 0; i < TimerLast; i++)
+			if (timers[i].when && (!next || timers[i].when < next))
+				next = timers[i].when;
+		if (next != timerarmed) {
+			its.it_value.tv_sec = next / 1000;
+			its.it_value.tv_nsec = (next % 1000) * 1000000;
+			timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+			timerarmed = next;
+		}
+		/* Send everything the handlers queued before going to sleep */
+		XFlush(dpy);
+		for (i = 0; nsubscribers && i < MAXCONNS; i++)
+			if (conns[i].fd >= 0 && conns[i].subscribed && conns[i].wlen)
+				connwrite(&conns[i]);
+		if (stallbudget)
+			watchset(0);
+		/* Stop accepting while the connection table is full */
+		fds[1].events = nconns < MAXCONNS ? POLLIN : 0;
+		/* IPC connections wait for requests, or for room for their replies */
+		for (nfds = 4, more = 0, i = 0; i < MAXCONNS; i++) {
+			if (conns[i].fd < 0)
+				continue;
+			more |= conns[i].more;
+			polled[nfds - 4] = &conns[i];
+			fds[nfds].fd = conns[i].fd;
+			fds[nfds].events = (conns[i].done || conns[i].subscribed
+				|| conns[i].wlen >= MAXPENDING ? 0 : POLLIN)
+				| (conns[i].wlen ? POLLOUT : 0);
+			fds[nfds++].revents = 0;
+		}
+		/* Poll the set of file descriptors, unless Xlib already queued events
+		 * while a handler waited for a reply, or a connection has requests left */
+		int num_ready = poll(fds, nfds, QLength(dpy) || more ? 0 : -1);
+		wakeups++;
+		if (stallbudget)
+			watchset(stallbudget * 1000LL);
+		if (num_ready >= 0) {
 			/* Check for X events without blocking */
-			while (XPending(dpy)) {
-				XNextEvent(dpy, &ev);
-				if (xhandler[ev.type]) {
-					xhandler[ev.type](&ev);
-				}
+			drainevents();
+			/* Serve IPC connections, then accept new ones */
+			for (i = 4; i < nfds; i++) {
+				/* notify() drops lagging subscribers, also since poll() */
+				if (polled[i - 4]->fd < 0)
+					continue;
+				if (fds[i].revents || polled[i - 4]->more)
+					connevent(polled[i - 4], fds[i].revents);
 			}
-			/* Handle socket event */
-			if (fds[1].revents & POLLIN) {
+			if (fds[1].revents & POLLIN)
 				dispatchsocketevent();
+			/* Run deferred work that is due */
+			if (fds[2].revents & POLLIN)
+				runtimers();
+			/* Titles drawn with a placeholder glyph get their font */
+			if (fds[3].revents & POLLIN && drw_fontset_poll(drw)) {
+				memset(barseg, 0, sizeof(barseg));
+				dirty |= DirtyBar;
 			}
 		}
 	}
 }
 
+/*
+ * runtimers() - Runs the deferred work whose deadline has passed.
+ * The timerfd is one-shot, so once it fired it is no longer armed.
+ */
+void
+runtimers(void)
+{
+	uint64_t expirations;
+	long long now = monotonicms();
+	int i;
+
+	if (read(timerfd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+		perror("timerfd read");
+	timerarmed = 0;
+	for (i = 0; i < TimerLast; i++) {
+		if (timers[i].when && timers[i].when <= now) {
+			timers[i].when = 0;
+			if (timers[i].func)
+				timers[i].func();
+		}
+	}
+}
+
 /*
  * scan() - Integrates pre-existing client windows into the window manager.
  */
@@ -1271,23 +2356,79 @@ scan(void)
 	}
 }
 
+/*
+ * selectclient() - Focuses the client with the window id in body.
+ * Ids are the ones GetClients and StateDump report, they stay valid while
+ * the window is managed. Unknown or stale ids are rejected with no reply.
+ */
 char*
 selectclient(char *body)
 {
-	int index, i = 0;
+	unsigned long win;
+	char *end;
+	Client *c;
 
-	if (body == NULL || (index = atoi(body)) < 0) 
+	if (body == NULL)
 		return NULL;
+	errno = 0;
+	win = strtoul(body, &end, 0);
+	if (end == body || *end || errno || !(c = wintoclient(win)))
+		return NULL;
+	focus(c);
+	arrange();
+	return c->name;
+}
 
-	/* Iterate through clients to find the requested one */
-	for (Client *c = mon.clients; c != NULL; c = c->next, ++i) {
-		if (i == index) {
-			focus(c);
-			arrange();
-			return c->name;
+/*
+ * sendclients() - Answers a binary GetClients request.
+ * Each client is an IpcClient record followed by its name, gathered
+ * IOVCHUNK clients at a time straight from the Client structs.
+ */
+void
+sendclients(Conn *c, IpcHeader *r)
+{
+	static IpcClient recs[IOVCHUNK];
+	struct iovec iov[1 + 2 * IOVCHUNK];
+	Client *cl;
+	int n = 0, k = 0;
+
+	for (r->len = 0, cl = mon.clients; cl; cl = cl->next)
+		r->len += sizeof(IpcClient) + cl->namelen;
+	iov[n].iov_base = r;
+	iov[n++].iov_len = sizeof *r;
+	for (cl = mon.clients; cl; cl = cl->next) {
+		recs[k].win = cl->win;
+		recs[k].floating = cl->isfloating;
+		recs[k].fixed = cl->isfixed;
+		recs[k].hidden = cl->ishidden;
+		recs[k].urgent = cl->isurgent;
+		recs[k].namelen = cl->namelen;
+		recs[k].pad = 0;
+		iov[n].iov_base = &recs[k++];
+		iov[n++].iov_len = sizeof(IpcClient);
+		iov[n].iov_base = cl->name;
+		iov[n++].iov_len = cl->namelen;
+		if (k == IOVCHUNK) {
+			connsend(c, iov, n);
+			n = k = 0;
 		}
 	}
-	return NULL;
+	if (n)
+		connsend(c, iov, n);
+}
+
+/*
+ * schedule() - Requests that deferred work runs in ms milliseconds.
+ * An earlier deadline already set for the same timer is kept. run() arms the
+ * timerfd for the earliest deadline before it goes back to poll().
+ */
+void
+schedule(int timer, long long ms)
+{
+	long long when = monotonicms() + ms;
+
+	if (!timers[timer].when || when < timers[timer].when)
+		timers[timer].when = when;
 }
 
 void
@@ -1299,6 +2440,37 @@ setclientstate(Client *c, long state)
 		PropModeReplace, (unsigned char *)data, 2);
 }
 
+/*
+ * sethidden() - Unmaps a tiled client that is covered by the top one, or maps it back.
+ * A hidden client is marked Iconic and _NET_WM_STATE_HIDDEN so that toolkits
+ * stop rendering into it. The UnmapNotify this causes is not a withdrawal,
+ * see unmapnotify().
+ */
+void
+sethidden(Client *c, int hidden)
+{
+	if (c->ishidden == hidden)
+		return;
+	c->ishidden = hidden;
+	if (hidden) {
+		/* an unmap the client did itself carries an earlier serial than
+		 * ours and is unmanaged as usual, no need to ask the server */
+		if (!c->ignoreunmap++)
+			c->unmapserial = NextRequest(dpy);
+		XUnmapWindow(dpy, c->win);
+		setclientstate(c, IconicState);
+		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
+			PropModeReplace, (unsigned char *)&netatom[NetWMStateHidden], 1);
+	} else {
+		setclientstate(c, NormalState);
+		XDeleteProperty(dpy, c->win, netatom[NetWMState]);
+		XMapWindow(dpy, c->win);
+		/* focus() could not reach it while it was unmapped */
+		if (c == mon.clients)
+			setfocus(c);
+	}
+}
+
 /*
  * sendevent() - Dispatches a client message event if the specified protocol is supported.
  * This function is critical for allowing the WM to communicate with client windows
@@ -1330,6 +2502,20 @@ sendevent(Client *c, Atom proto)
 	return exists;
 }
 
+/* setfloating() - Makes c floating at its previous geometry, or tiled. */
+void
+setfloating(Client *c, int floating)
+{
+	if (c->isfloating == floating)
+		return;
+	c->isfloating = floating;
+	if (c->isfloating)
+		resize(c, c->oldx, c->oldy, c->oldw, c->oldh);
+	else
+		resize(c, mon.wx, mon.wy, mon.ww, mon.wh);
+	arrange();
+}
+
 /*
  * setfocus() - Directs the input focus to a client window while ensuring WM state synchronization.
  * It is critical for maintaining consistent interactive state in the WM event loop.
@@ -1375,6 +2561,18 @@ setup(void)
 	/* clean up any zombies (inherited from .xinitrc etc) immediately */
 	while (waitpid(-1, NULL, WNOHANG) > 0);
 
+	/* stall watchdog, armed by run() around each batch of work */
+	if (stallbudget) {
+#ifdef __GLIBC__
+		void *frame;
+		backtrace(&frame, 1); /* loads libgcc now rather than in the handler */
+#endif
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = SA_RESTART;
+		sa.sa_handler = watchdog;
+		sigaction(SIGALRM, &sa, NULL);
+	}
+
 	/* init screen */
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
@@ -1397,6 +2595,7 @@ setup(void)
 	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
 	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
 	netatom[NetWMState] = XInternAtom(dpy, "_NET_WM_STATE", False);
+	netatom[NetWMStateHidden] = XInternAtom(dpy, "_NET_WM_STATE_HIDDEN", False);
 	netatom[NetWMCheck] = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False);
 	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
@@ -1436,6 +2635,39 @@ setup(void)
 	focus(NULL);
 	/* init stack socket */
 	setupsocket();
+	setupsnapshot();
+	/* init deferred work timer, armed by run() on demand */
+	if ((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0)
+		die("timerfd_create:");
+}
+
+/*
+ * setupsnapshot() - Creates the shared memory snapshot readers map.
+ * Without it wm works as before, tools just fall back to the socket.
+ */
+void
+setupsnapshot(void)
+{
+	Snapshot *s;
+	int fd;
+
+	if ((fd = shm_open(SNAP_NAME, O_CREAT|O_RDWR|O_CLOEXEC, 0644)) < 0) {
+		perror("wm: shm_open");
+		return;
+	}
+	if (ftruncate(fd, sizeof(Snapshot)) < 0
+	|| (s = mmap(NULL, sizeof(Snapshot), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror("wm: snapshot");
+		close(fd);
+		shm_unlink(SNAP_NAME);
+		return;
+	}
+	close(fd);
+	/* a wm that died mid-update may have left seq odd */
+	__atomic_store_n(&s->seq, (s->seq | 1) + 1, __ATOMIC_RELEASE);
+	s->version = SNAP_VERSION;
+	snapshot = s;
+	dirty |= DirtySnapshot;
 }
 
 /*
@@ -1447,6 +2679,10 @@ setup(void)
 void
 setupsocket(void) {
 	struct sockaddr_un addr;
+	int i;
+
+	for (i = 0; i < MAXCONNS; i++)
+		conns[i].fd = -1;
 
 	/* Create a socket */
 	if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) 
@@ -1516,29 +2752,83 @@ spawn(const Arg *arg)
 }
 
 static char* statedump(char *unused) {
-    static char dump[8192];
-    int len = 0;
-    len += snprintf(dump + len, sizeof(dump) - len,
-                    "{\n\"bar_visible\": %s,\n\"screen\": { \"w\": %d, \"h\": %d },\n",
-                    (mon.showbar ? "true" : "false"), sw, sh);
+    reply.len = 0;
+    bufprintf(&reply, "{\n\"bar_visible\": %s,\n\"screen\": { \"w\": %d, \"h\": %d },\n",
+              (mon.showbar ? "true" : "false"), sw, sh);
+    bufprintf(&reply, "\"events\": { \"received\": %lu, \"coalesced\": %lu, \"dispatched\": %lu },\n",
+              evreceived, evcoalesced, evdispatched);
+    bufprintf(&reply, "\"loop\": { \"wakeups\": %lu, \"wakeups_per_sec\": %.2f },\n",
+              wakeups, wakeuprate());
+    bufprintf(&reply, "\"active_client\": ");
     if (mon.clients)
-        len += snprintf(dump + len, sizeof(dump) - len,
-                        "\"active_client\": \"%s\",\n", mon.clients->name);
+        bufjson(&reply, mon.clients->name);
     else
-        len += snprintf(dump + len, sizeof(dump) - len,
-                        "\"active_client\": null,\n");
-    len += snprintf(dump + len, sizeof(dump) - len, "\"clients\": [\n");
-    int i = 0;
-    for (Client *c = mon.clients; c; c = c->next, i++) {
-         len += snprintf(dump + len, sizeof(dump) - len,
-                         "  { \"id\": %d, \"name\": \"%s\", \"geometry\": { \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d }, \"state\": \"%s\", \"isfixed\": %d }%s\n",
-                         i, c->name, c->x, c->y, c->w, c->h,
-                         (c->isfloating ? "Floating" : "Tiled"),
-                         c->isfixed,
-                         (c->next ? "," : ""));
+        bufprintf(&reply, "null");
+    bufprintf(&reply, ",\n\"clients\": [\n");
+    for (Client *c = mon.clients; c; c = c->next) {
+        bufprintf(&reply, "  { \"id\": \"0x%lx\", \"name\": ", c->win);
+        bufjson(&reply, c->name);
+        bufprintf(&reply, ", \"geometry\": { \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d }, \"state\": \"%s\", \"isfixed\": %d, \"ishidden\": %d }%s\n",
+                  c->x, c->y, c->w, c->h,
+                  (c->isfloating ? "Floating" : "Tiled"),
+                  c->isfixed, c->ishidden,
+                  (c->next ? "," : ""));
     }
-    len += snprintf(dump + len, sizeof(dump) - len, "]\n}\n");
-    return dump;
+    bufprintf(&reply, "]\n}\n");
+    return reply.data;
+}
+
+/*
+ * stats() - Reports handler latency per X event type and socket command.
+ * Only types that ran at least once are listed. A payload of "reset" clears
+ * all histograms after they have been reported.
+ */
+static char* stats(char *body) {
+	int i, first;
+
+	reply.len = 0;
+	bufprintf(&reply, "{\n  \"x\": {");
+	for (i = 0, first = 1; i < LASTEvent; i++) {
+		if (!xhist[i].count)
+			continue;
+		histwrite(&reply, xname[i].event, &xhist[i], first);
+		first = 0;
+	}
+	bufprintf(&reply, "\n  },\n  \"socket\": {");
+	for (i = 0, first = 1; i < LENGTH(shandler); i++) {
+		if (!shist[i].count)
+			continue;
+		histwrite(&reply, sname[i], &shist[i], first);
+		first = 0;
+	}
+	bufprintf(&reply, "\n  },\n  \"stalls\": %d\n}\n", (int)stalls);
+	if (body && !strcmp(body, "reset")) {
+		memset(xhist, 0, sizeof(xhist));
+		memset(shist, 0, sizeof(shist));
+		stalls = 0;
+	}
+	return reply.data;
+}
+
+/*
+ * subscribe() - Turns the requesting connection into an event stream.
+ * The payload optionally lists the wanted events, e.g. "focus,title";
+ * all of them are sent by default. Each event is one line, "<event> <args>",
+ * see notify(). The connection accepts no further requests.
+ */
+static char* subscribe(char *body) {
+	unsigned int mask = 0;
+	char *tok;
+	int i;
+
+	for (tok = body ? strtok(body, ", ") : NULL; tok; tok = strtok(NULL, ", "))
+		for (i = 0; i < SubLast; i++)
+			if (!strcmp(tok, subname[i]))
+				mask |= 1 << i;
+	if (!ipcconn->subscribed)
+		nsubscribers++;
+	ipcconn->subscribed = mask ? mask : (1 << SubLast) - 1;
+	return NULL;
 }
 
 void
@@ -1547,6 +2837,7 @@ togglebar(const Arg *arg)
 	mon.showbar = !mon.showbar;
 	updatebarpos();
 	XMoveResizeWindow(dpy, mon.barwin, mon.wx, mon.by, mon.ww, bh);
+	notify(SubBar, "%d", mon.showbar);
 	arrange();
 }
 
@@ -1561,12 +2852,7 @@ togglefloating(const Arg *arg)
 	XGetInputFocus(dpy, &focusedwin, &revert);
 	if (!(c = wintoclient(focusedwin)) || c->isfixed)
 		return;
-	c->isfloating = !c->isfloating;
-	if (c->isfloating)
-		resize(c, c->oldx, c->oldy, c->oldw, c->oldh);
-	else
-		resize(c, mon.wx, mon.wy, mon.ww, mon.wh);
-	arrange();
+	setfloating(c, !c->isfloating);
 }
 
 /*
@@ -1585,6 +2871,17 @@ unfocus(Client *c, int setfocus)
 	}
 }
 
+/* unhashclient() - Removes a client from the window to client index. */
+void
+unhashclient(Client *c)
+{
+	Client **tc;
+
+	for (tc = &clienttable[CLIENTHASH(c->win)]; *tc && *tc != c; tc = &(*tc)->hnext);
+	if (*tc)
+		*tc = c->hnext;
+}
+
 /*
  * unmanage() - Removes a client from the window management stack.
  * This function is critical because it consolidates all cleanup and removal operations
@@ -1596,6 +2893,8 @@ unmanage(Client *c, int destroyed)
 	XWindowChanges wc;
 
 	detach(c);
+	unhashclient(c);
+	notify(SubRemove, "0x%lx", c->win);
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -1611,7 +2910,7 @@ unmanage(Client *c, int destroyed)
 	free(c);
 	focus(NULL);
 	arrange();
-	updateclientlist();
+	dirty |= DirtyClientList;
 }
 
 /*
@@ -1630,11 +2929,17 @@ unmapnotify(XEvent *e)
 	if ((c = wintoclient(ev->window))) {
 		if (ev->send_event)
 			setclientstate(c, WithdrawnState);
+		else if (ev->event != root)
+			return; /* reported twice, act on the copy sent to root */
+		else if (c->ignoreunmap && ev->serial >= c->unmapserial)
+			c->ignoreunmap--; /* sethidden() */
 		else
 			unmanage(c, 0);
 	} else if (ev->window == mon.kbwin) {
+		notify(SubDock, "0 0x%lx", mon.kbwin);
 		mon.kbwin = 0;
 		mon.wh = mon.mh - (mon.showbar ? bh : 0);
+		mon.geomgen++;
 		arrange();
 	}
 }
@@ -1656,6 +2961,7 @@ updatebarpos()
 		mon.wy = mon.wy + bh; 
 	} else
 		mon.by = -bh;
+	mon.geomgen++;
 }
 
 /*
@@ -1666,13 +2972,63 @@ updatebarpos()
 void
 updateclientlist()
 {
+	static Window *wins;
+	static int cap;
 	Client *c;
+	int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
-	for (c = mon.clients; c; c = c->next)
-		XChangeProperty(dpy, root, netatom[NetClientList],
-			XA_WINDOW, 32, PropModeAppend,
-			(unsigned char *) &(c->win), 1);
+	/* the array only grows, so steady state costs a single request */
+	for (c = mon.clients; c; c = c->next) {
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			if (!(wins = realloc(wins, cap * sizeof *wins)))
+				die("cannot realloc %zu bytes:", cap * sizeof *wins);
+		}
+		wins[n++] = c->win;
+	}
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) wins, n);
+}
+
+/*
+ * updatesnapshot() - Publishes the client list, focus and bar state.
+ * Runs from commit() like updateclientlist(); readers retry while seq is
+ * odd or changed under them, see snapread().
+ */
+void
+updatesnapshot(void)
+{
+	SnapClient *sc;
+	Client *c;
+	uint32_t n = 0, total = 0;
+
+	if (!snapshot)
+		return;
+	__atomic_store_n(&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (c = mon.clients; c; c = c->next, total++) {
+		if (n == SNAP_MAXCLIENTS)
+			continue;
+		sc = &snapshot->clients[n++];
+		sc->win = c->win;
+		sc->x = c->x;
+		sc->y = c->y;
+		sc->w = c->w;
+		sc->h = c->h;
+		sc->floating = c->isfloating;
+		sc->fixed = c->isfixed;
+		sc->hidden = c->ishidden;
+		sc->urgent = c->isurgent;
+		memcpy(sc->name, c->name, c->namelen + 1);
+	}
+	snapshot->nclients = n;
+	snapshot->total = total;
+	snapshot->focus = mon.clients ? mon.clients->win : 0;
+	snapshot->showbar = mon.showbar;
+	snapshot->dock = mon.kbwin != 0;
+	snapshot->sw = sw;
+	snapshot->sh = sh;
+	__atomic_store_n(&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELEASE);
 }
 
 /*
@@ -1713,16 +3069,25 @@ updatestatus(void)
 {
 	if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
 		strcpy(stext, "wm");
-	drawbar();
+	dirty |= DirtyBar;
 }
 
 void
 updatetitle(Client *c)
 {
+	char old[sizeof c->name];
+
+	strcpy(old, c->name);
 	if (!gettextprop(c->win, netatom[NetWMName], c->name, sizeof c->name))
 		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
 	if (c->name[0] == '\0') /* hack to mark broken clients */
 		strcpy(c->name, broken);
+	c->namelen = strlen(c->name);
+	/* a new client is announced with its title by manage() */
+	if (old[0] && strcmp(old, c->name)) {
+		notify(SubTitle, "0x%lx %s", c->win, c->name);
+		dirty |= DirtySnapshot;
+	}
 }
 
 void
@@ -1753,17 +3118,105 @@ updatewmhints(Client *c)
 	}
 }
 
+/* wakeuprate() - Main loop wakeups per second since the previous call (StateDump). */
+double
+wakeuprate(void)
+{
+	static long long since;
+	static unsigned long base;
+	long long now = monotonicms();
+	double rate;
+
+	rate = since && now > since ? (wakeups - base) * 1000.0 / (now - since) : 0.0;
+	since = now;
+	base = wakeups;
+	return rate;
+}
+
 Client *
 wintoclient(Window w)
 {
 	Client *c;
 
-	for (c = mon.clients; c; c = c->next)
+	for (c = clienttable[CLIENTHASH(w)]; c; c = c->hnext)
 		if (c->win == w)
 			return c;
 	return NULL;
 }
 
+/* watchbegin() - Publishes the dispatch that is about to run for watchdog(). */
+void
+watchbegin(const char *event, const char *handler, Window w, long long start)
+{
+	dispatch.active = 0;
+	dispatch.seq++;
+	dispatch.start = start;
+	dispatch.event = event;
+	dispatch.handler = handler;
+	dispatch.win = w;
+	dispatch.active = 1;
+}
+
+/*
+ * watchdog() - SIGALRM handler of the stall watchdog.
+ * run() arms the timer for stallbudget while it works through a batch, so
+ * this only fires when that batch takes long. It runs on top of the stalled
+ * code, which makes the backtrace point right at it. A dispatch that has not
+ * used up its own budget yet just re-arms the timer for the remainder.
+ * backtrace() is not async-signal-safe while libgcc is not loaded yet;
+ * setup() calls it once beforehand so the handler never loads it itself.
+ * movemouse() and resizemouse() suspend the watchdog for their drag.
+ */
+void
+watchdog(int unused)
+{
+	static char msg[256];
+	long long elapsed, budget = stallbudget * 1000LL;
+	int n, saved = errno;
+
+	if (dispatch.active) {
+		elapsed = monotonicus() - dispatch.start;
+		if (elapsed < budget) {
+			watchset(budget - elapsed);
+			errno = saved;
+			return;
+		}
+		if (stallseq != dispatch.seq) {
+			stallseq = dispatch.seq;
+			stalls++;
+			n = snprintf(msg, sizeof msg, "wm: stall: %s handler %s on window 0x%lx running for %lld ms\n",
+				dispatch.event, dispatch.handler, (unsigned long)dispatch.win, elapsed / 1000);
+			if (write(STDERR_FILENO, msg, MIN(n, (int)sizeof msg - 1)) < 0)
+				;
+#ifdef __GLIBC__
+			void *frames[32];
+			backtrace_symbols_fd(frames, backtrace(frames, LENGTH(frames)), STDERR_FILENO);
+#endif
+		}
+	}
+	watchset(budget);
+	errno = saved;
+}
+
+/* watchend() - Marks the current dispatch as finished, logging how long a reported stall took. */
+void
+watchend(void)
+{
+	dispatch.active = 0;
+	if (stallseq == dispatch.seq && dispatch.seq)
+		fprintf(stderr, "wm: stall: %s handler %s finished after %lld ms\n",
+			dispatch.event, dispatch.handler, (monotonicus() - dispatch.start) / 1000);
+}
+
+/* watchset() - Arms the watchdog timer to fire in us microseconds, 0 disarms it. */
+void
+watchset(long long us)
+{
+	struct itimerval it = { { 0, 0 }, { us / 1000000, us % 1000000 } };
+
+	setitimer(ITIMER_REAL, &it, NULL);
+}
+
 /* There's no way to check accesses to destroyed windows, thus those cases are
  * ignored (especially on UnmapNotify's). Other types of errors call Xlibs
  * default error handler, which may call exit. */
@@ -4,6 +4,9 @@
 static const unsigned int borderpx = 1;           /* border pixel of windows */
 static const unsigned int snap     = 32;          /* snap pixel */
 static const int showbar           = 1;          /* 0 means no bar */
+static const int barinterval       = 16;         /* min ms between bar redraws, 0 to disable */
+static const int stallbudget       = 0;          /* ms one dispatch may take before it is logged, 0 to disable */
+static const int hidebackground    = 0;          /* 1 means unmap tiled clients below the top one */
 static const char *fonts[]         = { "monospace:size=10" };
 static const char dmenufont[]      = "monospace:size=10";
 static const char col_black[]      = "#000000";
@@ -0,0 +1,352 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * wmctl - talks to wm over its socket without spawning nc.
+ * Uses the binary protocol of ipc.h; one connection carries every request.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../common/util.h"
+#include "../wm/ipc.h"
+
+#define LENGTH(X)		(sizeof X / sizeof X[0])
+#define SOCKET_PATH		"/tmp/xwm"
+
+typedef struct {
+	char *data;
+	size_t len, cap;
+} Reply;
+
+static const struct { const char *name; int op; } cmds[] = {
+	{ "clients",   GetClients },
+	{ "select",    SelectClient },
+	{ "dump",      StateDump },
+	{ "quit",      Quit },
+	{ "stats",     Stats },
+	{ "keepalive", KeepAlive },
+	{ "subscribe", Subscribe },
+	{ "batch",     Batch },
+};
+
+static const char *statusname[] = {
+	[IpcOk] = "ok",
+	[IpcBadVersion] = "protocol version not supported",
+	[IpcBadOp] = "unknown command",
+	[IpcNotFound] = "no such client",
+};
+
+/* function declarations */
+static void append(char **buf, size_t *len, size_t *cap, const void *data, size_t n);
+static int batch(void);
+static void connectwm(void);
+static int lookup(const char *name);
+static int menu(char *argv[]);
+static void printreply(const IpcHeader *h, const Reply *r, FILE *fp);
+static void readn(void *buf, size_t len);
+static int reply(IpcHeader *h, Reply *r);
+static void request(int op, uint32_t id, const char *payload);
+static void usage(void);
+static void writen(const void *buf, size_t len);
+
+/* variables */
+static int sock;
+
+static void
+usage(void)
+{
+	die("usage: wmctl command [payload]\n"
+	    "       wmctl -b < commands\n"
+	    "       wmctl -m [menu options]\n"
+	    "commands: clients, select ID, dump, quit, stats [reset], subscribe [events],\n"
+	    "          batch \"select ID; floating [0|1]; bar [0|1]; kill\"");
+}
+
+static int
+lookup(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < LENGTH(cmds); i++)
+		if (!strcmp(name, cmds[i].name))
+			return cmds[i].op;
+	return -1;
+}
+
+static void
+readn(void *buf, size_t len)
+{
+	ssize_t n;
+
+	for (; len; len -= n, buf = (char *)buf + n)
+		if ((n = read(sock, buf, len)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			die("wmctl: connection closed by wm");
+		}
+}
+
+static void
+writen(const void *buf, size_t len)
+{
+	ssize_t n;
+
+	for (; len; len -= n, buf = (const char *)buf + n)
+		if ((n = write(sock, buf, len)) < 0) {
+			if (errno != EINTR)
+				die("wmctl: write:");
+			n = 0;
+		}
+}
+
+static void
+request(int op, uint32_t id, const char *payload)
+{
+	IpcHeader h = { IPC_MAGIC, IPC_VERSION, op, id, 0, 0 };
+
+	h.len = payload ? strlen(payload) : 0;
+	writen(&h, sizeof h);
+	writen(payload, h.len);
+}
+
+/* reply() - Reads the next reply into r, returns its status. */
+static int
+reply(IpcHeader *h, Reply *r)
+{
+	readn(h, sizeof *h);
+	if (h->magic != IPC_MAGIC)
+		die("wmctl: malformed reply");
+	if (h->len + 1 > r->cap) {
+		r->cap = h->len + 1;
+		if (!(r->data = realloc(r->data, r->cap)))
+			die("wmctl: realloc:");
+	}
+	readn(r->data, h->len);
+	r->data[h->len] = '\0';
+	r->len = h->len;
+	return h->status;
+}
+
+/* printreply() - Prints a reply the way the text protocol would. */
+static void
+printreply(const IpcHeader *h, const Reply *r, FILE *fp)
+{
+	const IpcClient *ic;
+	size_t off;
+
+	if (h->status != IpcOk) {
+		fprintf(stderr, "wmctl: %s\n", h->status < LENGTH(statusname)
+			? statusname[h->status] : "error");
+		return;
+	}
+	if (h->op != GetClients) {
+		fwrite(r->data, 1, r->len, fp);
+		if (r->len && r->data[r->len - 1] != '\n')
+			fputc('\n', fp);
+		return;
+	}
+	for (off = 0; off + sizeof *ic <= r->len; ) {
+		ic = (const IpcClient *)(r->data + off);
+		off += sizeof *ic;
+		fprintf(fp, "0x%x %.*s\n", (unsigned int)ic->win, ic->namelen, r->data + off);
+		off += ic->namelen;
+	}
+}
+
+static void
+connectwm(void)
+{
+	struct sockaddr_un addr;
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die("wmctl: socket:");
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("wmctl: connect %s:", SOCKET_PATH);
+}
+
+/* append() - Appends n bytes of data to the growing buffer *buf. */
+static void
+append(char **buf, size_t *len, size_t *cap, const void *data, size_t n)
+{
+	if (*len + n > *cap) {
+		*cap = MAX(*cap * 2, *len + n);
+		if (!(*buf = realloc(*buf, *cap)))
+			die("wmctl: realloc:");
+	}
+	memcpy(*buf + *len, data, n);
+	*len += n;
+}
+
+/*
+ * batch() - Pipelines one command per stdin line, then prints the replies in
+ * order. wm stops reading requests while too many replies are unread, so
+ * replies are read whenever they arrive, also before every request is out.
+ */
+static int
+batch(void)
+{
+	char *line = NULL, *payload, *out = NULL, *in = NULL, buf[4096];
+	size_t size = 0, olen = 0, ocap = 0, off = 0, ilen = 0, icap = 0, used;
+	ssize_t len;
+	uint32_t n = 0, i = 0;
+	struct pollfd pfd = { sock, 0, 0 };
+	IpcHeader h = { IPC_MAGIC, IPC_VERSION, 0, 0, 0, 0 };
+	Reply r = { 0 };
+	int op, ret = 0;
+
+	while ((len = getline(&line, &size, stdin)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (!len)
+			continue;
+		if ((payload = strchr(line, ' ')))
+			*payload++ = '\0';
+		if ((op = lookup(line)) < 0 || op == Subscribe) {
+			fprintf(stderr, "wmctl: %s: not a batch command\n", line);
+			ret = 1;
+			continue;
+		}
+		h.op = op;
+		h.id = n++;
+		h.len = payload ? strlen(payload) : 0;
+		append(&out, &olen, &ocap, &h, sizeof h);
+		append(&out, &olen, &ocap, payload, h.len);
+	}
+	free(line);
+	while (i < n) {
+		pfd.events = POLLIN | (off < olen ? POLLOUT : 0);
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("wmctl: poll:");
+		}
+		if (pfd.revents & POLLOUT) {
+			if ((len = send(sock, out + off, olen - off, MSG_DONTWAIT | MSG_NOSIGNAL)) > 0)
+				off += len;
+			else if (len < 0 && errno != EAGAIN && errno != EINTR)
+				die("wmctl: write:");
+		}
+		if (!(pfd.revents & (POLLIN|POLLHUP|POLLERR)))
+			continue;
+		if ((len = read(sock, buf, sizeof buf)) <= 0) {
+			if (len < 0 && errno == EINTR)
+				continue;
+			die("wmctl: connection closed by wm");
+		}
+		append(&in, &ilen, &icap, buf, len);
+		/* print every complete reply */
+		for (used = 0; i < n && ilen - used >= sizeof h; used += sizeof h + h.len, i++) {
+			memcpy(&h, in + used, sizeof h);
+			if (h.magic != IPC_MAGIC)
+				die("wmctl: malformed reply");
+			if (ilen - used - sizeof h < h.len)
+				break;
+			r.len = 0;
+			append(&r.data, &r.len, &r.cap, in + used + sizeof h, h.len);
+			if (h.status != IpcOk)
+				ret = 1;
+			printreply(&h, &r, stdout);
+		}
+		memmove(in, in + used, ilen - used);
+		ilen -= used;
+	}
+	free(out);
+	free(in);
+	free(r.data);
+	return ret;
+}
+
+/*
+ * menu() - Lets menu pick a client and focuses it, the job switch_app did
+ * with two nc and a cut.
+ */
+static int
+menu(char *argv[])
+{
+	int in[2], out[2], status;
+	char sel[512], *end;
+	IpcHeader h;
+	Reply r = { 0 };
+	FILE *fp;
+	pid_t pid;
+	unsigned long id;
+
+	/* menu may exit before it has read the list */
+	signal(SIGPIPE, SIG_IGN);
+	request(GetClients, 0, NULL);
+	if (reply(&h, &r) != IpcOk)
+		die("wmctl: cannot list clients");
+	if (pipe(in) < 0 || pipe(out) < 0)
+		die("wmctl: pipe:");
+	switch ((pid = fork())) {
+	case -1:
+		die("wmctl: fork:");
+	case 0:
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		close(in[0]); close(in[1]); close(out[0]); close(out[1]); close(sock);
+		argv[0] = "menu";
+		execvp(argv[0], argv);
+		die("wmctl: execvp %s:", argv[0]);
+	}
+	close(in[0]);
+	close(out[1]);
+	if (!(fp = fdopen(in[1], "w")))
+		die("wmctl: fdopen:");
+	printreply(&h, &r, fp);
+	fclose(fp);
+	if (!(fp = fdopen(out[0], "r")))
+		die("wmctl: fdopen:");
+	if (!fgets(sel, sizeof sel, fp))
+		sel[0] = '\0';
+	fclose(fp);
+	waitpid(pid, &status, 0);
+	id = strtoul(sel, &end, 16);
+	if (end == sel)
+		return 1; /* nothing selected */
+	snprintf(sel, sizeof sel, "0x%lx", id);
+	request(SelectClient, 1, sel);
+	if ((status = reply(&h, &r)) != IpcOk)
+		printreply(&h, &r, stderr);
+	free(r.data);
+	return status != IpcOk;
+}
+
+int
+main(int argc, char *argv[])
+{
+	IpcHeader h;
+	Reply r = { 0 };
+	int op, ret;
+
+	if (argc < 2)
+		usage();
+	connectwm();
+	if (!strcmp(argv[1], "-b") && argc == 2)
+		return batch();
+	if (!strcmp(argv[1], "-m") || !strcmp(argv[1], "--menu"))
+		return menu(argv + 1);
+	if ((op = lookup(argv[1])) < 0 || argc > 3)
+		usage();
+	request(op, 0, argc > 2 ? argv[2] : NULL);
+	do {
+		ret = reply(&h, &r);
+		printreply(&h, &r, stdout);
+		fflush(stdout);
+	} while (op == Subscribe && ret == IpcOk);
+	free(r.data);
+	return ret != IpcOk;
+}